@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <unordered_map>
 #include "Instruction.h"
 #include "Assembler.h"
+#include "Optimizer.h"
 
 static constexpr uint16_t Opcode_CLS = 0x00E0;
 static constexpr uint16_t Opcode_RET = 0x00EE;
@@ -42,25 +44,62 @@ static constexpr uint16_t Opcode_LD_B_dst = 0xF033;
 static constexpr uint16_t Opcode_LD_I_regs = 0xF055;
 static constexpr uint16_t Opcode_LD_regs_I = 0xF065;
 
-void AssemblerError(int line, const char* fmt, ...)
+/* Operands of an instruction being assembled, encoded into a word once they are all known */
+struct InstructionBuilder
+{
+    Instruction::Type     type;
+    Instruction::Encoding encoding;
+    uint16_t              instruction;
+    uint16_t              address;
+    uint8_t               dst;
+    uint8_t               src;
+    uint8_t               byte;
+};
+
+static void Report(const char* severity, int line, int column, const char* fmt, va_list args)
 {
     char errorBuf[1024];
+
+    vsprintf_s(errorBuf, fmt, args);
+    if (column > 0)
+        printf("%s at line %d, column %d: %s\n", severity, line, column, errorBuf);
+    else
+        printf("%s at line %d: %s\n", severity, line, errorBuf);
+}
+
+void AssemblerError(int line, int column, const char* fmt, ...)
+{
     va_list args;
 
     va_start(args, fmt);
-    vsprintf_s(errorBuf, fmt, args);
-    printf("ERROR at line %d: %s\n", line, errorBuf);
+    Report("ERROR", line, column, fmt, args);
     va_end(args);
 }
 
-void AssemblerWarning(int line, const char* fmt, ...)
+void AssemblerError(const Token& token, const char* fmt, ...)
 {
-    char errorBuf[1024];
     va_list args;
 
     va_start(args, fmt);
-    vsprintf_s(errorBuf, fmt, args);
-    printf("WARNING at line %d: %s\n", line, errorBuf);
+    Report("ERROR", token.line, token.column, fmt, args);
+    va_end(args);
+}
+
+void AssemblerWarning(int line, int column, const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    Report("WARNING", line, column, fmt, args);
+    va_end(args);
+}
+
+void AssemblerWarning(const Token& token, const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    Report("WARNING", token.line, token.column, fmt, args);
     va_end(args);
 }
 
@@ -115,9 +154,9 @@ static Instruction::Type GetInstructionType(
 
     if (token.keyword == Keyword::JP)
     {
-        if (dstType == Token::Type::Keyword && dst->text == "V0")
+        if (dstType == Token::Type::Keyword && dst->keyword == Keyword::V0)
             return Instruction::Type::JP_V0_IMM;
-        else if (dstType == Token::Type::Immediate || dstType == Token::Type::Identifier)
+        else if (dstType == Token::Type::Immediate || dstType == Token::Type::Identifier || dstType == Token::Type::Expression)
             return Instruction::Type::JP;
     }
 
@@ -126,7 +165,7 @@ static Instruction::Type GetInstructionType(
     {
         if (dstType == Token::Type::Keyword)
         {
-            if (dst->keyword == Keyword::I && srcType == Token::Type::Immediate)
+            if (dst->keyword == Keyword::I && (srcType == Token::Type::Immediate || srcType == Token::Type::Identifier || srcType == Token::Type::Expression))
                 return Instruction::Type::LD_I_IMM;
             else if (dst->keyword == Keyword::DT && srcType == Token::Type::Keyword)
                 return Instruction::Type::LD_DT_V;
@@ -149,8 +188,70 @@ static Instruction::Type GetInstructionType(
     return Instruction::Type::UNKNOWN;
 }
 
+/**
+ * Warn when a computed operand does not fit its field
+ * @param kind   Field the value goes into
+ * @param value  Value of the operand
+ * @param line   Line of the operand
+ * @param column Column of the operand
+ */
+static void WarnTruncated(Fixup::Kind kind, int value, int line, int column)
+{
+    switch (kind)
+    {
+    case Fixup::Kind::Address:
+        if (value < 0 || value > 0xFFF)
+            AssemblerWarning(line, column, "value 0x%X truncated to 12 bits", value);
+        break;
+    case Fixup::Kind::Byte:
+        if (value < -128 || value > 0xFF)
+            AssemblerWarning(line, column, "value %d truncated to 8 bits", value);
+        break;
+    case Fixup::Kind::Nibble:
+        if (value < 0 || value > 0xF)
+            AssemblerWarning(line, column, "value %d truncated to 4 bits", value);
+        break;
+    }
+}
+
+/**
+ * Get the value of an immediate or expression operand. Expressions that
+ * depend on symbols which are not defined yet get a fixup and read as 0.
+ * @param state   Assembler state
+ * @param operand Immediate or expression token
+ * @param kind    Field the value goes into
+ * @param value   Receives the value
+ * @return True on success, false if the expression is malformed
+ */
+static bool ResolveOperand(AssemblerState& state, const Token& operand, Fixup::Kind kind, int& value)
+{
+    ExpressionValue result;
+
+    if (operand.type == Token::Type::Immediate)
+    {
+        value = operand.value;
+        return true;
+    }
+
+    if (!ParseExpression(state, operand, result))
+        return false;
+
+    /* Remember operands that the optimizer cannot move along with the code */
+    if (kind == Fixup::Kind::Address && !result.symbolic)
+        state.literalAddresses.push_back(state.address);
+    else if (kind != Fixup::Kind::Address && result.symbolic)
+        state.layoutDependentData = true;
+
+    value = result.value;
+    if (result.root != -1)
+        state.fixups.push_back({ kind, state.address, operand.line, operand.column, result.symbol, result.root });
+    else
+        WarnTruncated(kind, value, operand.line, operand.column);
+    return true;
+}
+
 static int AssembleDstInstruction(
-    Instruction& instruction,
+    InstructionBuilder& instruction,
     const Token& token,
     const Token* dst)
 {
@@ -159,20 +260,20 @@ static int AssembleDstInstruction(
 
     if (!dst)
     {
-        AssemblerError(token.line, "instruction missing destination operand");
+        AssemblerError(token, "instruction missing destination operand");
         return 1;
     }
 
     if (dst->type != Token::Type::Keyword)
     {
-        AssemblerError(token.line, "invalid destination register '%s'", dst->text.c_str());
+        AssemblerError(*dst, "invalid destination register '%.*s'", (int)dst->text.size(), dst->text.data());
         return 2;
     }
 
     vIndex = static_cast<int>(dst->keyword) - static_cast<int>(Keyword::V0);
     if (vIndex < 0 || vIndex > 15)
     {
-        AssemblerError(token.line, "invalid destination register '%s'", dst->text.c_str());
+        AssemblerError(*dst, "invalid destination register '%.*s'", (int)dst->text.size(), dst->text.data());
         return 2;
     }
 
@@ -210,7 +311,8 @@ static int AssembleDstInstruction(
 }
 
 static int AssembleDstSrcInstruction(
-    Instruction& instruction,
+    InstructionBuilder& instruction,
+    AssemblerState& state,
     const Token& token,
     const Token* dst,
     const Token* src)
@@ -219,33 +321,37 @@ static int AssembleDstSrcInstruction(
 
     if (!dst)
     {
-        AssemblerError(token.line, "instruction missing destination operand");
+        AssemblerError(token, "instruction missing destination operand");
         return 1;
     }
 
     if (!src)
     {
-        AssemblerError(token.line, "instruction missing source operand");
+        AssemblerError(token, "instruction missing source operand");
         return 2;
     }
 
     if (dst->type != Token::Type::Keyword)
     {
-        AssemblerError(token.line, "invalid destination register '%s'", dst->text.c_str());
+        AssemblerError(*dst, "invalid destination register '%.*s'", (int)dst->text.size(), dst->text.data());
         return 2;
     }
 
     vIndex = static_cast<int>(dst->keyword) - static_cast<int>(Keyword::V0);
     if (vIndex < 0 || vIndex > 15)
     {
-        AssemblerError(token.line, "invalid destination register '%s'", dst->text.c_str());
+        AssemblerError(*dst, "invalid destination register '%.*s'", (int)dst->text.size(), dst->text.data());
         return 2;
     }
     instruction.dst = vIndex;
 
-    if (src->type == Token::Type::Immediate)
+    if (src->type == Token::Type::Immediate || src->type == Token::Type::Expression)
     {
-        instruction.byte = static_cast<uint8_t>(src->value);
+        int value = 0;
+        if (!ResolveOperand(state, *src, Fixup::Kind::Byte, value))
+            return -1;
+
+        instruction.byte = static_cast<uint8_t>(value);
         instruction.encoding = Instruction::Encoding::DestinationByte;
         switch (instruction.type)
         {
@@ -262,7 +368,7 @@ static int AssembleDstSrcInstruction(
             instruction.instruction = Opcode_ADD_dst_imm;
             break;
         default:
-            AssemblerError(token.line, "instruction '%s' has no immediate form", token.text.c_str());
+            AssemblerError(token, "instruction '%.*s' has no immediate form", (int)token.text.size(), token.text.data());
             break;
         }
     }
@@ -271,7 +377,7 @@ static int AssembleDstSrcInstruction(
         vIndex = static_cast<int>(src->keyword) - static_cast<int>(Keyword::V0);
         if (vIndex < 0 || vIndex > 15)
         {
-            AssemblerError(token.line, "invalid source register '%s'", dst->text.c_str());
+            AssemblerError(*src, "invalid source register '%.*s'", (int)src->text.size(), src->text.data());
             return 2;
         }
 
@@ -314,7 +420,8 @@ static int AssembleDstSrcInstruction(
 }
 
 static int AssembleDstSrcNibInstruction(
-    Instruction& instruction,
+    InstructionBuilder& instruction,
+    AssemblerState& state,
     const Token& token,
     const Token* dst,
     const Token* src,
@@ -324,51 +431,55 @@ static int AssembleDstSrcNibInstruction(
 
     if (!dst)
     {
-        AssemblerError(token.line, "instruction missing destination operand");
+        AssemblerError(token, "instruction missing destination operand");
         return 1;
     }
     else if (!src)
     {
-        AssemblerError(token.line, "instruction missing source operand");
+        AssemblerError(token, "instruction missing source operand");
         return 2;
     }
     else if (!nib)
     {
-        AssemblerError(token.line, "instruction missing 4-bit integer operand");
+        AssemblerError(token, "instruction missing 4-bit integer operand");
         return 3;
     }
 
     if (dst->type != Token::Type::Keyword)
     {
-        AssemblerError(token.line, "invalid destination register '%s'", dst->text.c_str());
+        AssemblerError(*dst, "invalid destination register '%.*s'", (int)dst->text.size(), dst->text.data());
         return 4;
     }
     else if (src->type != Token::Type::Keyword)
     {
-        AssemblerError(token.line, "invalid source register '%s'", src->text.c_str());
+        AssemblerError(*src, "invalid source register '%.*s'", (int)src->text.size(), src->text.data());
         return 4;
     }
-    else if (nib->type != Token::Type::Immediate)
+    else if (nib->type != Token::Type::Immediate && nib->type != Token::Type::Expression)
     {
-        AssemblerError(token.line, "invalid 4-bit immediate value '%s'", nib->text.c_str());
+        AssemblerError(*nib, "invalid 4-bit immediate value '%.*s'", (int)nib->text.size(), nib->text.data());
         return 4;
     }
 
     vIndex = static_cast<int>(dst->keyword) - static_cast<int>(Keyword::V0);
     if (vIndex < 0 || vIndex > 15)
     {
-        AssemblerError(token.line, "invalid destination register '%s'", dst->text.c_str());
+        AssemblerError(*dst, "invalid destination register '%.*s'", (int)dst->text.size(), dst->text.data());
         return 4;
     }
     instruction.dst = vIndex;
     vIndex = static_cast<int>(src->keyword) - static_cast<int>(Keyword::V0);
     if (vIndex < 0 || vIndex > 15)
     {
-        AssemblerError(token.line, "invalid source register '%s'", src->text.c_str());
+        AssemblerError(*src, "invalid source register '%.*s'", (int)src->text.size(), src->text.data());
         return 4;
     }
     instruction.src = vIndex;
-    instruction.byte = nib->value;
+
+    int value = 0;
+    if (!ResolveOperand(state, *nib, Fixup::Kind::Nibble, value))
+        return -1;
+    instruction.byte = static_cast<uint8_t>(value);
 
     if (instruction.type == Instruction::Type::DRW)
     {
@@ -380,7 +491,7 @@ static int AssembleDstSrcNibInstruction(
 }
 
 static int AssembleAddrInstruction(
-    Instruction& instruction,
+    InstructionBuilder& instruction,
     AssemblerState& state,
     const Token& token,
     const Token* addr)
@@ -390,7 +501,7 @@ static int AssembleAddrInstruction(
 
     if (!addr)
     {
-        AssemblerError(token.line, "instruction missing address operand");
+        AssemblerError(token, "instruction missing address operand");
         return tokenLength;
     }
 
@@ -399,16 +510,33 @@ static int AssembleAddrInstruction(
     if (addr->type == Token::Type::Immediate)
     {
         instruction.address = addr->value;
+        state.literalAddresses.push_back(state.address);
     }
     else if (addr->type == Token::Type::Identifier)
     {
-        if (state.symbols.count(addr->text) == 0)
+        int id = addr->symbol;
+
+        /* Forward references are patched once the whole program is assembled */
+        if (id == state.here)
         {
-            AssemblerError(token.line, "use of undeclared identifier '%s'", addr->text.c_str());
-            return 2;
+            instruction.address = state.address;
         }
-
-        instruction.address = state.symbols.at(addr->text);
+        else if (state.symbols.IsDefined(id))
+        {
+            instruction.address = state.symbols.GetValue(id);
+        }
+        else
+        {
+            state.fixups.push_back({ Fixup::Kind::Address, state.address, addr->line, addr->column, id, -1 });
+            instruction.address = 0;
+        }
+    }
+    else if (addr->type == Token::Type::Expression)
+    {
+        int value = 0;
+        if (!ResolveOperand(state, *addr, Fixup::Kind::Address, value))
+            return -1;
+        instruction.address = value;
     }
 
     switch (instruction.type)
@@ -434,26 +562,21 @@ static int AssembleAddrInstruction(
 }
 
 /**
- * Assemble the instruction starting at tokens[index]
+ * Assemble the instruction starting at tokens[0]
  * @param bytesOut Output vector
  * @param state    Assembler state
- * @param index    Token index
+ * @param tokens   Instruction token followed by its operands
+ * @param count    Number of tokens available from tokens[0] on
  * @return How many tokens long the instruction was, or -1 if there was an error
  */
-static int AssembleInstruction(std::vector<uint8_t>& bytesOut, AssemblerState& state, int index)
+static int AssembleInstruction(std::vector<uint8_t>& bytesOut, AssemblerState& state, const Token* tokens, size_t count)
 {
-    const Token& token = state.tokens[index];
-    const Token* dst = ((index + 1) < state.tokens.size())
-        ? &state.tokens[index + 1]
-        : nullptr;
-    const Token* src = ((index + 2) < state.tokens.size())
-        ? &state.tokens[index + 2]
-        : nullptr;
-    const Token* nibble = ((index + 3) < state.tokens.size())
-        ? &state.tokens[index + 3]
-        : nullptr;
-
-    Instruction instruction{ };
+    const Token& token = tokens[0];
+    const Token* dst = (count > 1) ? &tokens[1] : nullptr;
+    const Token* src = (count > 2) ? &tokens[2] : nullptr;
+    const Token* nibble = (count > 3) ? &tokens[3] : nullptr;
+
+    InstructionBuilder instruction{ };
     int tokenLength = 1;
 
     instruction.type = GetInstructionType(token, dst, src);
@@ -494,13 +617,16 @@ static int AssembleInstruction(std::vector<uint8_t>& bytesOut, AssemblerState& s
     case Instruction::Type::AND:
     case Instruction::Type::XOR:
     case Instruction::Type::SUBN:
-        tokenLength = AssembleDstSrcInstruction(instruction, token, dst, src);
+        tokenLength = AssembleDstSrcInstruction(instruction, state, token, dst, src);
         break;
     case Instruction::Type::DRW:
-        tokenLength = AssembleDstSrcNibInstruction(instruction, token, dst, src, nibble);
+        tokenLength = AssembleDstSrcNibInstruction(instruction, state, token, dst, src, nibble);
         break;
     }
 
+    if (tokenLength == -1)
+        return -1;
+
     /* "Assemble" the instruction based on its encoding */
     if (instruction.encoding == Instruction::Encoding::Address)
         instruction.instruction |= (instruction.address & 0xFFF);
@@ -520,46 +646,208 @@ static int AssembleInstruction(std::vector<uint8_t>& bytesOut, AssemblerState& s
     return tokenLength;
 }
 
-bool Assemble(std::vector<uint8_t>& bytesOut, const std::string& code, int origin)
+/**
+ * Patch every recorded fixup now that all symbols are known
+ * @param bytesOut Assembled program
+ * @param state    Assembler state
+ * @return True if every fixup was resolved, false otherwise
+ */
+static bool ResolveFixups(std::vector<uint8_t>& bytesOut, AssemblerState& state)
 {
-    AssemblerState state(origin);
-    int index = 0;
+    /* First fixup and reference count of each missing symbol, indexed by id */
+    std::vector<int> firstUse(state.symbols.GetCount(), -1);
+    std::vector<int> references(state.symbols.GetCount(), 0);
+    std::vector<int> unresolved;
 
-    bytesOut.reserve(1024);
+    bool failed = false;
 
-    if (!TokenizeCode(state.tokens, code))
+    for (size_t i = 0; i < state.fixups.size(); i++)
     {
-        return false;
+        const Fixup& fixup = state.fixups[i];
+        size_t offset = fixup.address - state.origin;
+        int value = 0;
+        int missing = fixup.symbol;
+        bool resolved = false;
+
+        if (fixup.expression < 0)
+        {
+            resolved = state.symbols.IsDefined(fixup.symbol);
+            if (resolved)
+                value = state.symbols.GetValue(fixup.symbol);
+        }
+        else
+        {
+            resolved = EvaluateExpression(state, fixup.expression, value, missing);
+        }
+
+        if (!resolved)
+        {
+            if (missing < 0)
+            {
+                AssemblerError(fixup.line, fixup.column, "division by zero");
+                failed = true;
+            }
+            else if (references[missing]++ == 0)
+            {
+                firstUse[missing] = static_cast<int>(i);
+                unresolved.push_back(missing);
+            }
+            continue;
+        }
+
+        uint16_t word = (bytesOut[offset] << 8) | bytesOut[offset + 1];
+        if (fixup.expression >= 0)
+        {
+            WarnTruncated(fixup.kind, value, fixup.line, fixup.column);
+        }
+        else if (value > 0xFFF)
+        {
+            std::string_view name = state.symbols.GetName(fixup.symbol);
+            AssemblerWarning(fixup.line, fixup.column, "address of '%.*s' (0x%X) truncated to 12 bits", (int)name.size(), name.data(), value);
+        }
+
+        switch (fixup.kind)
+        {
+        case Fixup::Kind::Address:
+            word = (word & 0xF000) | (value & 0xFFF);
+            break;
+        case Fixup::Kind::Byte:
+            word = (word & 0xFF00) | (value & 0xFF);
+            break;
+        case Fixup::Kind::Nibble:
+            word = (word & 0xFFF0) | (value & 0xF);
+            break;
+        }
+
+        bytesOut[offset] = word >> 8;
+        bytesOut[offset + 1] = word & 0xFF;
     }
 
-    while (index < state.tokens.size())
+    /* Report each missing symbol once, at its first use */
+    for (int id : unresolved)
     {
-        const Token& token = state.tokens[index];
-        int stride = 1;
+        const Fixup& fixup = state.fixups[firstUse[id]];
+        std::string_view missing = state.symbols.GetName(id);
+
+        if (references[id] > 1)
+            AssemblerError(fixup.line, fixup.column, "use of undeclared identifier '%.*s' (%d references)", (int)missing.size(), missing.data(), references[id]);
+        else
+            AssemblerError(fixup.line, fixup.column, "use of undeclared identifier '%.*s'", (int)missing.size(), missing.data());
+
+        for (int other = 0; other < static_cast<int>(state.symbols.GetCount()); other++)
+        {
+            std::string_view name = state.symbols.GetName(other);
+            if (state.symbols.IsDefined(other) && name.size() == missing.size()
+                && std::equal(name.begin(), name.end(), missing.begin(),
+                    [](char a, char b) { return toupper(a) == toupper(b); }))
+            {
+                AssemblerError(fixup.line, fixup.column, "did you mean '%.*s'?", (int)name.size(), name.data());
+                break;
+            }
+        }
+    }
 
-        state.symbols["$"] = state.address;
+    return unresolved.empty() && !failed;
+}
+
+/**
+ * Replace the names of labels and identifiers with ids into the symbol table
+ * @param state Assembler state with its tokens filled in
+ */
+static void InternSymbols(AssemblerState& state)
+{
+    for (Token& token : state.tokens)
+    {
+        if (token.type == Token::Type::Label || token.type == Token::Type::Identifier)
+            token.symbol = state.symbols.Intern(token.text);
+    }
+}
+
+/**
+ * Assemble a run of tokens at state.address, defining the labels among them
+ * @param bytesOut Output vector
+ * @param state    Assembler state, with symbol ids already interned
+ * @param tokens   First token
+ * @param count    Number of tokens
+ * @return True on success, false otherwise. Undefined symbols are left in state.fixups.
+ */
+bool AssembleTokens(std::vector<uint8_t>& bytesOut, AssemblerState& state, const Token* tokens, size_t count)
+{
+    size_t index = 0;
+
+    while (index < count)
+    {
+        const Token& token = tokens[index];
+        int stride = 1;
 
         switch (token.type)
         {
         case Token::Type::Label:
-            state.symbols[token.text] = state.address;
+            if (token.symbol == state.here)
+            {
+                AssemblerError(token, "'$' is reserved for the current address");
+                return false;
+            }
+            state.symbols.SetValue(token.symbol, state.address);
             break;
         case Token::Type::Keyword:
-            stride = AssembleInstruction(bytesOut, state, index);
+            stride = AssembleInstruction(bytesOut, state, &tokens[index], count - index);
             if (stride == -1)
                 return false;
             state.address += 2;
             break;
         case Token::Type::Immediate:
-            AssemblerError(token.line, "stray immediate value '%s'", token.text.c_str());
+            AssemblerError(token, "stray immediate value '%.*s'", (int)token.text.size(), token.text.data());
             return false;
         case Token::Type::Expression:
-            AssemblerError(token.line, "stray expression '%s'", token.text.c_str());
+            AssemblerError(token, "stray expression '%.*s'", (int)token.text.size(), token.text.data());
             return false;
         }
 
         index += stride;
     }
 
+    return true;
+}
+
+/**
+ * Assemble a program
+ * @param bytesOut Receives the program
+ * @param code     Source code
+ * @param origin   Address the program is loaded at
+ * @param optimize Run the peephole optimizer over the result
+ * @return True on success, false otherwise
+ */
+bool Assemble(std::vector<uint8_t>& bytesOut, std::string_view code, int origin, bool optimize)
+{
+    AssemblerState state(origin);
+
+    /* Fixups and the optimizer address the output relative to the origin */
+    bytesOut.clear();
+
+    /* Rough guesses from typical sources, so large programs grow their buffers rarely */
+    state.tokens.reserve(code.size() / 4 + 16);
+    state.symbols.Reserve(code.size() / 64 + 16);
+    bytesOut.reserve(std::max<size_t>(1024, code.size() / 4));
+
+    if (!TokenizeCode(state.tokens, code))
+    {
+        return false;
+    }
+
+    InternSymbols(state);
+
+    if (!AssembleTokens(bytesOut, state, state.tokens.data(), state.tokens.size()))
+        return false;
+
+    if (!ResolveFixups(bytesOut, state))
+        return false;
+
+    if (optimize)
+    {
+        OptimizerReport report;
+        OptimizeProgram(bytesOut, state, report);
+        PrintOptimizerReport(report);
+    }
     return true;
 }
\ No newline at end of file
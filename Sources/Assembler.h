@@ -1,26 +1,55 @@
 #pragma once
 
-#include <unordered_map>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <cstddef>
 #include <cstdarg>
 
+#include "Expression.h"
+#include "SymbolTable.h"
 #include "Tokenizer.h"
 
+/* A reference to a symbol that was not defined yet when it was used */
+struct Fixup
+{
+    enum class Kind : int
+    {
+        Address,    // Low 12 bits of the instruction word
+        Byte,       // Low 8 bits
+        Nibble      // Low 4 bits
+    };
+
+    Kind        kind;
+    int         address;    // Address of the instruction to patch
+    int         line;
+    int         column;
+    int         symbol;     // Id in AssemblerState::symbols, the first undefined one for expressions
+    int         expression; // Root node in AssemblerState::expressions, or -1 for a plain symbol
+};
+
 struct AssemblerState
 {
-    std::unordered_map<std::string, uint16_t> symbols;
+    SymbolTable        symbols;
     std::vector<Token> tokens;
+    std::vector<Fixup> fixups;
+    std::vector<ExpressionNode> expressions;
+    std::vector<int>   literalAddresses;    // Instructions whose address operand is a plain number
+    bool               layoutDependentData; // Some byte or nibble operand depends on label addresses
 
     int line;
+    int origin;
     int address;
+    int here;       // Symbol id of '$', which always means the current address
 
-    AssemblerState(int origin = 0)
-        : line(0), address(origin) { }
+    AssemblerState(int _origin = 0)
+        : layoutDependentData(false), line(0), origin(_origin), address(_origin), here(symbols.Intern("$")) { }
 };
 
-void AssemblerError(int line, const char* fmt, ...);
-void AssemblerWarning(int line, const char* fmt, ...);
-bool Assemble(std::vector<uint8_t>& bytesOut, const std::string& code, int origin = 0x200);
\ No newline at end of file
+void AssemblerError(int line, int column, const char* fmt, ...);
+void AssemblerError(const Token& token, const char* fmt, ...);
+void AssemblerWarning(int line, int column, const char* fmt, ...);
+void AssemblerWarning(const Token& token, const char* fmt, ...);
+bool AssembleTokens(std::vector<uint8_t>& bytesOut, AssemblerState& state, const Token* tokens, size_t count);
+bool Assemble(std::vector<uint8_t>& bytesOut, std::string_view code, int origin = 0x200, bool optimize = false);
\ No newline at end of file
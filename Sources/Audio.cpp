@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "Audio.h"
+
+static constexpr int16_t Amplitude = 4096;
+
+/* XO-CHIP plays the pattern at 4000 bits per second at pitch 64, and doubles the rate every 48 steps */
+static double GetPatternStep(uint8_t pitch)
+{
+    return 4000.0 * std::pow(2.0, (pitch - 64) / 48.0) / AudioOutput::SampleRate;
+}
+
+AudioOutput::AudioOutput()
+    : m_Device(0), m_Dropped(0), m_SamplesPerCycle(0), m_Anchored(false),
+    m_AnchorCycle(0), m_AnchorSample(0), m_Position(0), m_ToneOn(false),
+    m_Pattern{ }, m_Phase(0), m_Step(0)
+{
+
+}
+
+AudioOutput::~AudioOutput()
+{
+    Close();
+}
+
+/**
+ * Open the default audio device and start playing
+ * @param cyclesPerSecond Speed the core runs at, used to turn event cycles into sample times
+ * @return True on success, false otherwise
+ */
+bool AudioOutput::Open(double cyclesPerSecond)
+{
+    SDL_AudioSpec desired{ };
+    SDL_AudioSpec obtained{ };
+
+    Close();
+
+    /* The callback is not running, so this thread can drain the queue and reset its state */
+    while (m_Events.Peek() != nullptr)
+        m_Events.Pop();
+    m_Dropped.store(0, std::memory_order_relaxed);
+    m_SamplesPerCycle = SampleRate / cyclesPerSecond;
+    m_Anchored = false;
+    m_Position = 0;
+    m_ToneOn = false;
+    std::fill_n(m_Pattern, sizeof(m_Pattern), 0xF0);
+    m_Phase = 0;
+    m_Step = GetPatternStep(64);
+
+    desired.freq = SampleRate;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = BufferSamples;
+    desired.callback = Callback;
+    desired.userdata = this;
+
+    m_Device = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, 0);
+    if (m_Device == 0)
+    {
+        printf("ERROR: failed to open an audio device: %s\n", SDL_GetError());
+        return false;
+    }
+
+    SDL_PauseAudioDevice(m_Device, 0);
+    return true;
+}
+
+void AudioOutput::Close()
+{
+    /* Waits for a running callback to return */
+    if (m_Device != 0)
+        SDL_CloseAudioDevice(m_Device);
+    m_Device = 0;
+}
+
+void AudioOutput::OnAudioEvent(const AudioEvent& event)
+{
+    if (m_Device == 0)
+        return;
+
+    if (!m_Events.Push(event))
+        m_Dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SDLCALL AudioOutput::Callback(void* userdata, Uint8* stream, int length)
+{
+    AudioOutput& output = *static_cast<AudioOutput*>(userdata);
+    output.Render(reinterpret_cast<int16_t*>(stream), length / static_cast<int>(sizeof(int16_t)));
+}
+
+/**
+ * Work out the sample an event plays on. Cycles are mapped to samples from
+ * an anchor, which is moved when the emulator drifts too far from the
+ * output, for example after it was paused or could not keep up.
+ * @param event Event at the front of the queue
+ * @return Sample the event plays on
+ */
+uint64_t AudioOutput::Schedule(const AudioEvent& event)
+{
+    uint64_t sample = 0;
+
+    if (m_Anchored && event.cycle >= m_AnchorCycle)
+        sample = m_AnchorSample + static_cast<uint64_t>((event.cycle - m_AnchorCycle) * m_SamplesPerCycle);
+
+    if (!m_Anchored || event.cycle < m_AnchorCycle
+        || sample + LatencySamples < m_Position
+        || sample > m_Position + MaximumLeadSamples)
+    {
+        m_Anchored = true;
+        m_AnchorCycle = event.cycle;
+        m_AnchorSample = m_Position + LatencySamples;
+        sample = m_AnchorSample;
+    }
+    return sample;
+}
+
+void AudioOutput::Apply(const AudioEvent& event)
+{
+    switch (event.kind)
+    {
+    case AudioEvent::Kind::ToneOn:
+        m_ToneOn = true;
+        break;
+    case AudioEvent::Kind::ToneOff:
+        m_ToneOn = false;
+        break;
+    case AudioEvent::Kind::Pattern:
+        std::copy_n(event.pattern, sizeof(m_Pattern), m_Pattern);
+        break;
+    case AudioEvent::Kind::Pitch:
+        m_Step = GetPatternStep(event.pitch);
+        break;
+    }
+}
+
+/**
+ * Fill an output buffer, applying each queued event on its own sample
+ * @param samples Buffer to fill
+ * @param count   Number of samples in the buffer
+ */
+void AudioOutput::Render(int16_t* samples, int count)
+{
+    for (int n = 0; n < count; n++, m_Position++)
+    {
+        for (const AudioEvent* event = m_Events.Peek(); event != nullptr && Schedule(*event) <= m_Position; event = m_Events.Peek())
+        {
+            Apply(*event);
+            m_Events.Pop();
+        }
+
+        if (!m_ToneOn)
+        {
+            samples[n] = 0;
+            continue;
+        }
+
+        int bit = static_cast<int>(m_Phase);
+        samples[n] = (m_Pattern[bit >> 3] & (0x80 >> (bit & 7))) ? Amplitude : -Amplitude;
+
+        m_Phase += m_Step;
+        if (m_Phase >= 128)
+            m_Phase -= 128;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <SDL.h>
+#include "Core.h"
+#include "SpscRing.h"
+
+/**
+ * Sound output for a core. Audio events are queued by the emulation thread
+ * and applied by the SDL audio callback on the exact sample their cycle maps
+ * to, so the sound follows the program rather than the 60Hz frame. The
+ * callback never locks or allocates.
+ *
+ * The output plays the XO-CHIP pattern buffer at the XO-CHIP pitch while the
+ * sound timer is running. Until a program loads a pattern the buffer holds a
+ * square wave, which gives the usual 500Hz CHIP-8 beep.
+ */
+class AudioOutput : public AudioListener
+{
+public:
+    constexpr static int SampleRate = 48000;
+    constexpr static int BufferSamples = 512;
+
+    AudioOutput();
+    AudioOutput(const AudioOutput&) = delete;
+    ~AudioOutput();
+
+    AudioOutput& operator=(const AudioOutput&) = delete;
+
+    bool Open(double cyclesPerSecond);
+    void Close();
+
+    bool IsOpen() const { return m_Device != 0; }
+
+    /* Events lost because the audio callback stopped draining the queue */
+    uint32_t GetDroppedEvents() const { return m_Dropped.load(std::memory_order_relaxed); }
+
+    void OnAudioEvent(const AudioEvent& event) override;
+private:
+    /*
+     * Delay from the callback that first sees an event to the sample it plays
+     * on, kept under one buffer. The events of a frame arrive together but are
+     * spread from the anchor by their cycle, so this only has to cover jitter
+     * in when the frames run.
+     */
+    constexpr static int LatencySamples = BufferSamples / 2;
+    /* Events further than this ahead of the output move the anchor instead of waiting, a quarter second */
+    constexpr static int MaximumLeadSamples = SampleRate / 4;
+
+    SDL_AudioDeviceID m_Device;
+    SpscRing<AudioEvent, 256> m_Events;
+    std::atomic<uint32_t> m_Dropped;
+
+    /* Only touched by the audio callback while the device is open */
+    double   m_SamplesPerCycle;
+    bool     m_Anchored;
+    uint64_t m_AnchorCycle;     // Cycle that maps to m_AnchorSample
+    uint64_t m_AnchorSample;
+    uint64_t m_Position;        // Samples rendered since the device was opened
+    bool     m_ToneOn;
+    uint8_t  m_Pattern[16];
+    double   m_Phase;           // Bit of the pattern being played
+    double   m_Step;            // Pattern bits per output sample
+
+    static void SDLCALL Callback(void* userdata, Uint8* stream, int length);
+
+    uint64_t Schedule(const AudioEvent& event);
+    void Apply(const AudioEvent& event);
+    void Render(int16_t* samples, int count);
+};
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include "CodeMap.h"
+
+static bool IsSkip(Instruction::Type type)
+{
+    return type == Instruction::Type::SE
+        || type == Instruction::Type::SNE
+        || type == Instruction::Type::SKP
+        || type == Instruction::Type::SKNP;
+}
+
+/* Instructions that end a basic block */
+static bool IsTerminator(Instruction::Type type)
+{
+    return type == Instruction::Type::JP
+        || type == Instruction::Type::JP_V0_IMM
+        || type == Instruction::Type::CALL
+        || type == Instruction::Type::RET
+        || IsSkip(type);
+}
+
+/**
+ * Build the code map of a program by recursive descent from its origin
+ * @param code   Program to analyze, only read during construction
+ * @param length Length of the program in bytes
+ * @param origin Address of the first byte, also the entry point
+ */
+CodeMap::CodeMap(const uint8_t* code, size_t length, int origin)
+    : m_Origin(origin), m_Flags(length, 0)
+{
+    std::vector<int> pending = { origin };
+
+    AddFlags(origin, Label);
+    while (!pending.empty())
+    {
+        int entry = pending.back();
+        pending.pop_back();
+        Trace(code, entry, pending);
+    }
+
+    BuildBlocks(code);
+}
+
+const BasicBlock* CodeMap::FindBlock(int address) const
+{
+    auto it = m_Blocks.upper_bound(static_cast<uint16_t>(address));
+    if (it == m_Blocks.begin())
+        return nullptr;
+
+    --it;
+    if (address >= it->second.end)
+        return nullptr;
+    return &it->second;
+}
+
+/**
+ * Follow straight-line code from entry until control leaves it, queueing
+ * every other target found on the way
+ */
+void CodeMap::Trace(const uint8_t* code, int entry, std::vector<int>& pending)
+{
+    int ip = entry;
+
+    while (Contains(ip) && Contains(ip + 1))
+    {
+        /* Stop at code that was already traced, or that would overlap it */
+        if ((m_Flags[ip - m_Origin] & (Code | Operand)) || (m_Flags[ip + 1 - m_Origin] & Code))
+            return;
+
+        Instruction ins(ReadWord(code, ip));
+        if (ins.type == Instruction::Type::UNKNOWN)
+            return;
+
+        m_Flags[ip - m_Origin] |= Code;
+        m_Flags[ip + 1 - m_Origin] |= Operand;
+
+        switch (ins.type)
+        {
+        case Instruction::Type::JP:
+            AddFlags(ins.GetAddress(), Label);
+            pending.push_back(ins.GetAddress());
+            return;
+        case Instruction::Type::JP_V0_IMM:
+            AddFlags(ins.GetAddress(), Label | JumpTable);
+            ScanJumpTable(code, ins.GetAddress(), pending);
+            return;
+        case Instruction::Type::RET:
+            return;
+        case Instruction::Type::CALL:
+            AddFlags(ins.GetAddress(), Label | Subroutine);
+            pending.push_back(ins.GetAddress());
+            break;
+        case Instruction::Type::SE:
+        case Instruction::Type::SNE:
+        case Instruction::Type::SKP:
+        case Instruction::Type::SKNP:
+            pending.push_back(ip + 4);
+            break;
+        case Instruction::Type::LD_I_IMM:
+            AddFlags(ins.GetAddress(), DataRef);
+            break;
+        default:
+            break;
+        }
+
+        ip += 2;
+    }
+}
+
+/**
+ * JP V0, addr can land anywhere in the 256 bytes after addr. The usual idiom
+ * is a table of jumps indexed by an even V0, so every consecutive JP starting
+ * at the base is treated as an entry point.
+ */
+void CodeMap::ScanJumpTable(const uint8_t* code, int base, std::vector<int>& pending)
+{
+    std::vector<uint16_t>& entries = m_JumpTables[static_cast<uint16_t>(base)];
+
+    if (!entries.empty())
+        return;
+
+    entries.push_back(static_cast<uint16_t>(base));
+    pending.push_back(base);
+
+    for (int entry = base; entry < base + MaxJumpTableLength && Contains(entry + 1); entry += 2)
+    {
+        Instruction ins(ReadWord(code, entry));
+        if (ins.type != Instruction::Type::JP)
+            break;
+
+        AddFlags(entry, Label);
+        if (entry != base)
+            entries.push_back(static_cast<uint16_t>(entry));
+        pending.push_back(entry);
+    }
+}
+
+/**
+ * Split the traced code into basic blocks. A block starts at a label or after
+ * a terminator, and ends at a terminator or where the next block starts.
+ */
+void CodeMap::BuildBlocks(const uint8_t* code)
+{
+    const int end = m_Origin + static_cast<int>(m_Flags.size());
+    std::vector<bool> leaders(m_Flags.size() + 4, false);
+
+    for (int ip = m_Origin; ip < end; ip++)
+    {
+        if ((m_Flags[ip - m_Origin] & Code) == 0)
+            continue;
+
+        Instruction ins(ReadWord(code, ip));
+        if (m_Flags[ip - m_Origin] & Label)
+            leaders[ip - m_Origin] = true;
+        if (IsTerminator(ins.type))
+            leaders[ip + 2 - m_Origin] = true;
+        if (IsSkip(ins.type))
+            leaders[ip + 4 - m_Origin] = true;
+    }
+
+    int ip = m_Origin;
+    while (ip < end)
+    {
+        if ((m_Flags[ip - m_Origin] & Code) == 0)
+        {
+            ++ip;
+            continue;
+        }
+
+        BasicBlock block{ static_cast<uint16_t>(ip), 0, 0, { } };
+        Instruction ins;
+
+        do {
+            ins = Instruction(ReadWord(code, ip));
+            block.last = static_cast<uint16_t>(ip);
+            ip += 2;
+        } while (ip < end
+            && (m_Flags[ip - m_Origin] & Code)
+            && !leaders[ip - m_Origin]
+            && !IsTerminator(ins.type));
+
+        block.end = static_cast<uint16_t>(ip);
+
+        switch (ins.type)
+        {
+        case Instruction::Type::JP:
+            block.successors.push_back(ins.GetAddress());
+            break;
+        case Instruction::Type::CALL:
+            block.successors.push_back(ins.GetAddress());
+            block.successors.push_back(block.last + 2);
+            break;
+        case Instruction::Type::RET:
+            break;
+        case Instruction::Type::JP_V0_IMM:
+            block.successors = m_JumpTables[ins.GetAddress()];
+            break;
+        default:
+            block.successors.push_back(block.last + 2);
+            if (IsSkip(ins.type))
+                block.successors.push_back(block.last + 4);
+            break;
+        }
+
+        m_Blocks.emplace(block.start, std::move(block));
+    }
+}
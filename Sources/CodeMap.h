@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "Instruction.h"
+
+struct BasicBlock
+{
+    uint16_t start;
+    uint16_t end;                       // One past the last byte of the block
+    uint16_t last;                      // Address of the block's final instruction
+    std::vector<uint16_t> successors;   // Statically known successors, empty after RET
+};
+
+/**
+ * Map of which bytes of a program are reachable code, built by following
+ * every jump, call and skip from the origin instead of sweeping linearly.
+ * Bytes that are never reached are treated as data.
+ */
+class CodeMap
+{
+public:
+    enum Flags : uint8_t
+    {
+        Code       = 1 << 0,    // First byte of a reachable instruction
+        Operand    = 1 << 1,    // Second byte of a reachable instruction
+        Label      = 1 << 2,    // Target of a jump or call
+        Subroutine = 1 << 3,    // Target of a CALL
+        DataRef    = 1 << 4,    // Loaded into I by LD I, addr
+        JumpTable  = 1 << 5     // Base address of a JP V0, addr
+    };
+
+    CodeMap(const uint8_t* code, size_t length, int origin);
+
+    int GetOrigin() const { return m_Origin; }
+    size_t GetLength() const { return m_Flags.size(); }
+
+    bool Contains(int address) const
+    {
+        return address >= m_Origin && address < m_Origin + static_cast<int>(m_Flags.size());
+    }
+
+    uint8_t GetFlags(int address) const
+    {
+        return Contains(address) ? m_Flags[address - m_Origin] : 0;
+    }
+
+    bool IsCode(int address) const { return (GetFlags(address) & (Code | Operand)) != 0; }
+    bool IsData(int address) const { return Contains(address) && !IsCode(address); }
+
+    const std::map<uint16_t, BasicBlock>& GetBlocks() const { return m_Blocks; }
+    const BasicBlock* FindBlock(int address) const;
+private:
+    /* Longest jump table scanned after a JP V0, addr, V0 can add at most 255 */
+    constexpr static int MaxJumpTableLength = 256;
+
+    int m_Origin;
+    std::vector<uint8_t> m_Flags;
+    std::map<uint16_t, BasicBlock> m_Blocks;
+    std::map<uint16_t, std::vector<uint16_t>> m_JumpTables;
+
+    void Trace(const uint8_t* code, int entry, std::vector<int>& pending);
+    void ScanJumpTable(const uint8_t* code, int base, std::vector<int>& pending);
+    void BuildBlocks(const uint8_t* code);
+
+    void AddFlags(int address, uint8_t flags)
+    {
+        if (Contains(address))
+            m_Flags[address - m_Origin] |= flags;
+    }
+
+    uint16_t ReadWord(const uint8_t* code, int address) const
+    {
+        return (code[address - m_Origin] << 8) | code[address - m_Origin + 1];
+    }
+};
@@ -0,0 +1,281 @@
+#include <cstdio>
+#include <climits>
+#include "Condition.h"
+#include "Core.h"
+#include "ExpressionParser.h"
+
+/**
+ * Builder for ExpressionParser that writes the stack program in postfix
+ * order, folding operators whose operands are constants. Nodes are the
+ * length of the program after their code.
+ */
+class ConditionCompiler
+{
+public:
+    using Node = int;
+    using Code = Condition::Code;
+
+    ConditionCompiler(Condition& condition, std::string_view text)
+        : m_Condition(condition), m_Text(text), m_Ok(true), m_Depth(0)
+    {
+
+    }
+
+    bool IsOk() const { return m_Ok; }
+
+    static bool IsNameChar(char c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || c == '#';
+    }
+
+    static bool IsUnaryOperator(char c) { return c == '!' || c == '-' || c == '~'; }
+    static char GetClosing(char open) { return (open == '(') ? ')' : ((open == '[') ? ']' : '\0'); }
+    static bool Accepts(ExpressionOperator op) { return op != ExpressionOperator::None; }
+
+    template <typename ...Args>
+    void Error(size_t position, const char* fmt, Args... args)
+    {
+        if (m_Ok)
+        {
+            printf("ERROR: ");
+            printf(fmt, args...);
+            printf(" at column %d of condition '%.*s'\n", static_cast<int>(position) + 1,
+                static_cast<int>(m_Text.size()), m_Text.data());
+        }
+        m_Ok = false;
+    }
+
+    int Constant(int value)
+    {
+        return Push(Code::Constant, value);
+    }
+
+    int Name(std::string_view name, size_t position)
+    {
+        Keyword keyword;
+        int value = 0;
+
+        if (name[0] == '#')
+        {
+            if (!ParseInteger(name.substr(1), value))
+                Error(position, "invalid number '%.*s'", static_cast<int>(name.size()) - 1, name.data() + 1);
+            return Push(Code::Constant, value);
+        }
+        else if (LookupKeyword(name, keyword) && keyword >= Keyword::V0 && keyword <= Keyword::VF)
+            return Push(Code::V, static_cast<int>(keyword) - static_cast<int>(Keyword::V0));
+        else if (LookupKeyword(name, keyword) && keyword == Keyword::I)
+            return Push(Code::I);
+        else if (LookupKeyword(name, keyword) && keyword == Keyword::DT)
+            return Push(Code::DT);
+        else if (LookupKeyword(name, keyword) && keyword == Keyword::ST)
+            return Push(Code::ST);
+        else if (name.size() == 2 && (name[0] | 0x20) == 'i' && (name[1] | 0x20) == 'p')
+            return Push(Code::IP);
+        else if (name.size() == 2 && (name[0] | 0x20) == 's' && (name[1] | 0x20) == 'p')
+            return Push(Code::SP);
+
+        Error(position, "unknown name '%.*s'", static_cast<int>(name.size()), name.data());
+        return Push(Code::Constant);
+    }
+
+    int Unary(char op, int operand)
+    {
+        Code code = (op == '!') ? Code::Not : ((op == '-') ? Code::Negate : Code::Complement);
+        Condition::Op* last = Last();
+
+        if (last == nullptr || last->code != Code::Constant)
+            return Emit(code);
+
+        switch (code)
+        {
+        case Code::Not:        last->value = !last->value; break;
+        case Code::Negate:     last->value = static_cast<int32_t>(0u - static_cast<uint32_t>(last->value)); break;
+        case Code::Complement: last->value = ~last->value; break;
+        }
+        return m_Condition.m_Length;
+    }
+
+    int Binary(ExpressionOperator op, int left, int right, size_t position)
+    {
+        Code code = GetCode(op);
+        Condition::Op* leftOp = Last(1);
+        Condition::Op* rightOp = Last();
+
+        m_Depth--;
+        if (rightOp->code == Code::Constant && (leftOp == nullptr || leftOp->code != Code::Constant))
+        {
+            *rightOp = { code, true, rightOp->value };
+            return m_Condition.m_Length;
+        }
+        if (leftOp == nullptr || leftOp->code != Code::Constant || rightOp->code != Code::Constant)
+            return Emit(code);
+
+        /* Both operands are single constants, the right one directly after the left */
+        if ((code == Code::Divide || code == Code::Modulo) && rightOp->value == 0)
+            Error(position, "division by zero");
+        leftOp->value = Condition::Apply(code, leftOp->value, rightOp->value);
+        return --m_Condition.m_Length;
+    }
+
+    int Group(char open, int inner)
+    {
+        return (open == '[') ? Emit(Code::Memory) : inner;
+    }
+private:
+    Condition&       m_Condition;
+    std::string_view m_Text;
+    bool             m_Ok;
+    int              m_Depth;   // Values on the stack at this point of the program
+
+    Condition::Op* Last(int back = 0)
+    {
+        int index = m_Condition.m_Length - 1 - back;
+        return (index >= 0) ? &m_Condition.m_Code[index] : nullptr;
+    }
+
+    int Emit(Code code, int32_t value = 0)
+    {
+        if (m_Condition.m_Length == Condition::MaxLength)
+            Error(m_Text.size(), "condition is too long");
+        else
+            m_Condition.m_Code[m_Condition.m_Length++] = { code, false, value };
+        return m_Condition.m_Length;
+    }
+
+    int Push(Code code, int32_t value = 0)
+    {
+        if (++m_Depth > Condition::MaxDepth)
+            Error(m_Text.size(), "condition is nested too deeply");
+        return Emit(code, value);
+    }
+
+    static Code GetCode(ExpressionOperator op)
+    {
+        switch (op)
+        {
+        case ExpressionOperator::LogicalOr:    return Code::LogicalOr;
+        case ExpressionOperator::LogicalAnd:   return Code::LogicalAnd;
+        case ExpressionOperator::Or:           return Code::Or;
+        case ExpressionOperator::Xor:          return Code::Xor;
+        case ExpressionOperator::And:          return Code::And;
+        case ExpressionOperator::Equal:        return Code::Equal;
+        case ExpressionOperator::NotEqual:     return Code::NotEqual;
+        case ExpressionOperator::Less:         return Code::Less;
+        case ExpressionOperator::LessEqual:    return Code::LessEqual;
+        case ExpressionOperator::Greater:      return Code::Greater;
+        case ExpressionOperator::GreaterEqual: return Code::GreaterEqual;
+        case ExpressionOperator::ShiftLeft:    return Code::ShiftLeft;
+        case ExpressionOperator::ShiftRight:   return Code::ShiftRight;
+        case ExpressionOperator::Add:          return Code::Add;
+        case ExpressionOperator::Subtract:     return Code::Subtract;
+        case ExpressionOperator::Multiply:     return Code::Multiply;
+        case ExpressionOperator::Divide:       return Code::Divide;
+        }
+        return Code::Modulo;
+    }
+};
+
+/**
+ * Parse a condition and compile it. Errors are printed.
+ * @param text Condition, empty for one that is always true
+ * @return True on success, false if the condition is malformed
+ */
+bool Condition::Compile(std::string_view text)
+{
+    m_Length = 0;
+    if (text.find_first_not_of(" \t") == std::string_view::npos)
+        return true;
+
+    ConditionCompiler compiler(*this, text);
+    ExpressionParser<ConditionCompiler> parser(compiler, text);
+    parser.Parse();
+    if (!compiler.IsOk())
+    {
+        m_Length = 0;
+        return false;
+    }
+    return true;
+}
+
+/* Arithmetic wraps and division by zero gives zero, so no condition can fault */
+int32_t Condition::Apply(Code code, int32_t a, int32_t b)
+{
+    uint32_t ua = static_cast<uint32_t>(a);
+    uint32_t ub = static_cast<uint32_t>(b);
+
+    switch (code)
+    {
+    case Code::Multiply:     return static_cast<int32_t>(ua * ub);
+    case Code::Divide:       return (b == 0 || (a == INT32_MIN && b == -1)) ? 0 : a / b;
+    case Code::Modulo:       return (b == 0 || (a == INT32_MIN && b == -1)) ? 0 : a % b;
+    case Code::Add:          return static_cast<int32_t>(ua + ub);
+    case Code::Subtract:     return static_cast<int32_t>(ua - ub);
+    case Code::ShiftLeft:    return static_cast<int32_t>(ua << (b & 31));
+    case Code::ShiftRight:   return a >> (b & 31);
+    case Code::Less:         return a < b;
+    case Code::LessEqual:    return a <= b;
+    case Code::Greater:      return a > b;
+    case Code::GreaterEqual: return a >= b;
+    case Code::Equal:        return a == b;
+    case Code::NotEqual:     return a != b;
+    case Code::And:          return a & b;
+    case Code::Xor:          return a ^ b;
+    case Code::Or:           return a | b;
+    case Code::LogicalAnd:   return a && b;
+    case Code::LogicalOr:    return a || b;
+    default:                 return 0;
+    }
+}
+
+/**
+ * Test the condition against the current state of a core
+ * @param core Core to test
+ * @return True if the condition holds or is empty
+ */
+bool Condition::Evaluate(const Core& core) const
+{
+    /* The top of the stack stays in a local, so most operators never touch memory */
+    int32_t stack[MaxDepth];
+    int32_t top = 1;
+    int depth = 0;
+
+    for (int pc = 0; pc < m_Length; pc++)
+    {
+        const Op& op = m_Code[pc];
+        int32_t right = 0;
+
+        if (op.code < Code::Memory)
+            stack[depth++] = top;
+        else if (op.code >= Code::Multiply)
+        {
+            right = op.immediate ? op.value : top;
+            if (!op.immediate)
+                top = stack[--depth];
+        }
+
+        switch (op.code)
+        {
+        case Code::Constant:     top = op.value; break;
+        case Code::V:            top = core.GetV(op.value); break;
+        case Code::I:            top = core.GetI(); break;
+        case Code::DT:           top = core.GetDT(); break;
+        case Code::ST:           top = core.GetST(); break;
+        case Code::IP:           top = core.GetIP(); break;
+        case Code::SP:           top = core.GetSP(); break;
+        case Code::Memory:       top = core.ReadByte(static_cast<uint16_t>(top)); break;
+        case Code::Not:          top = !top; break;
+        case Code::Negate:       top = static_cast<int32_t>(0u - static_cast<uint32_t>(top)); break;
+        case Code::Complement:   top = ~top; break;
+        case Code::Less:         top = top < right; break;
+        case Code::LessEqual:    top = top <= right; break;
+        case Code::Greater:      top = top > right; break;
+        case Code::GreaterEqual: top = top >= right; break;
+        case Code::Equal:        top = top == right; break;
+        case Code::NotEqual:     top = top != right; break;
+        case Code::LogicalAnd:   top = top && right; break;
+        case Code::LogicalOr:    top = top || right; break;
+        default:                 top = Apply(op.code, top, right); break;
+        }
+    }
+    return top != 0;
+}
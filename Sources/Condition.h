@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <string_view>
+
+class Core;
+
+/**
+ * Condition on the state of a core, like "V3 == 0x10 && I > 0x300", compiled
+ * once into a short stack program so it can be tested on every breakpoint
+ * hit in a few nanoseconds. Operands are V0-VF, I, DT, ST, IP, SP, numbers
+ * and [address] for a byte of memory, combined with the C operators.
+ */
+class Condition
+{
+public:
+    constexpr static int MaxLength = 64;
+    constexpr static int MaxDepth = 16;
+
+    /* An empty condition is always true */
+    Condition() : m_Length(0), m_Code{ } { }
+
+    bool Compile(std::string_view text);
+    bool Evaluate(const Core& core) const;
+
+    bool IsEmpty() const { return m_Length == 0; }
+private:
+    enum class Code : uint8_t
+    {
+        Constant,   // value
+        V,          // V[value]
+        I,
+        DT,
+        ST,
+        IP,
+        SP,
+        Memory,     // Byte at the address on the stack
+        Not,
+        Negate,
+        Complement,
+        Multiply,
+        Divide,
+        Modulo,
+        Add,
+        Subtract,
+        ShiftLeft,
+        ShiftRight,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+        And,
+        Xor,
+        Or,
+        LogicalAnd,
+        LogicalOr
+    };
+
+    /* Binary operators whose right operand is a constant carry it in value instead of popping it */
+    struct Op
+    {
+        Code    code;
+        bool    immediate;
+        int32_t value;
+    };
+
+    int m_Length;
+    std::array<Op, MaxLength> m_Code;
+
+    static int32_t Apply(Code code, int32_t a, int32_t b);
+
+    friend class ConditionCompiler;
+};
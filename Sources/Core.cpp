@@ -1,17 +1,18 @@
+#include <cstddef>
+#include <type_traits>
 #include "Core.h"
 #include "Instruction.h"
 
 Core::Core()
-    : m_Registers{ }, m_DisplayDirty(true), m_WaitingForKey(false), m_KeyDst(0), m_KeyStates(0)
+    : m_Registers{ }, m_PageGenerations{ }, m_MemoryGeneration(0),
+    m_DisplayDirty(true), m_WaitingForKey(false), m_KeyDst(0), m_KeyStates(0),
+    m_Cycles(0), m_AudioListener(nullptr), m_RandomState(1)
 {
     std::fill_n(m_DisplayBitmap.begin(), m_DisplayBitmap.size(), 0);
-    std::fill_n(m_DisplayBuffer.begin(), m_DisplayBuffer.size(), 0);
+    std::fill_n(m_Memory.begin(), m_Memory.size(), 0);
     std::copy_n(s_CharSprites.begin(), s_CharSprites.size(), m_Memory.begin());
-}
-
-Core::~Core()
-{
-
+    m_Memory[MemorySize] = m_Memory[0];
+    m_DirtyLines.set();
 }
 
 void Core::DoCycle()
@@ -31,112 +32,112 @@ void Core::DoCycle()
         pcInc = 0;
         break;
     case Instruction::Type::JP:
-        m_Registers.ip = ins.address;
+        m_Registers.ip = ins.GetAddress();
         pcInc = 0;
         break;
     case Instruction::Type::JP_V0_IMM:
-        m_Registers.ip = ins.address + m_Registers.v[0];
+        m_Registers.ip = ins.GetAddress() + m_Registers.v[0];
         pcInc = 0;
         break;
     case Instruction::Type::CALL:
         m_Registers.stack[m_Registers.sp++] = m_Registers.ip + 2;
-        m_Registers.ip = ins.address;
+        m_Registers.ip = ins.GetAddress();
         pcInc = 0;
         break;
     case Instruction::Type::SE:
         if (ins.encoding == Instruction::Encoding::DestinationByte)
         {
-            if (m_Registers.v[ins.dst] == ins.byte)
+            if (m_Registers.v[ins.GetDst()] == ins.GetByte())
                 pcInc = 4;
         }
         else if (ins.encoding == Instruction::Encoding::DestinationSource)
         {
-            if (m_Registers.v[ins.dst] == m_Registers.v[ins.src])
+            if (m_Registers.v[ins.GetDst()] == m_Registers.v[ins.GetSrc()])
                 pcInc = 4;
         }
         break;
     case Instruction::Type::SNE:
         if (ins.encoding == Instruction::Encoding::DestinationByte)
         {
-            if (m_Registers.v[ins.dst] != ins.byte)
+            if (m_Registers.v[ins.GetDst()] != ins.GetByte())
                 pcInc = 4;
         }
         else if (ins.encoding == Instruction::Encoding::DestinationSource)
         {
-            if (m_Registers.v[ins.dst] != m_Registers.v[ins.src])
+            if (m_Registers.v[ins.GetDst()] != m_Registers.v[ins.GetSrc()])
                 pcInc = 4;
         }
         break;
     case Instruction::Type::LD:
         if (ins.encoding == Instruction::Encoding::DestinationByte)
-            m_Registers.v[ins.dst] = ins.byte;
+            m_Registers.v[ins.GetDst()] = ins.GetByte();
         else if (ins.encoding == Instruction::Encoding::DestinationSource)
-            m_Registers.v[ins.dst] = m_Registers.v[ins.src];
+            m_Registers.v[ins.GetDst()] = m_Registers.v[ins.GetSrc()];
         break;
     case Instruction::Type::ADD:
         if (ins.encoding == Instruction::Encoding::DestinationByte)
-            m_Registers.v[ins.dst] += ins.byte;
+            m_Registers.v[ins.GetDst()] += ins.GetByte();
         else if (ins.encoding == Instruction::Encoding::DestinationSource)
         {
-            temp = static_cast<int>(m_Registers.v[ins.dst]) + m_Registers.v[ins.src];
+            temp = static_cast<int>(m_Registers.v[ins.GetDst()]) + m_Registers.v[ins.GetSrc()];
             m_Registers.v[0xf] = temp > 255;
-            m_Registers.v[ins.dst] = temp & 0xff;
+            m_Registers.v[ins.GetDst()] = temp & 0xff;
         }
         break;
     case Instruction::Type::OR:
-        m_Registers.v[ins.dst] |= m_Registers.v[ins.src];
+        m_Registers.v[ins.GetDst()] |= m_Registers.v[ins.GetSrc()];
         break;
     case Instruction::Type::AND:
-        m_Registers.v[ins.dst] &= m_Registers.v[ins.src];
+        m_Registers.v[ins.GetDst()] &= m_Registers.v[ins.GetSrc()];
         break;
     case Instruction::Type::XOR:
-        m_Registers.v[ins.dst] ^= m_Registers.v[ins.src];
+        m_Registers.v[ins.GetDst()] ^= m_Registers.v[ins.GetSrc()];
         break;
     case Instruction::Type::SUB:
-        m_Registers.v[0xf] = m_Registers.v[ins.dst] > m_Registers.v[ins.src];
-        m_Registers.v[ins.dst] = m_Registers.v[ins.dst] - m_Registers.v[ins.src];
+        m_Registers.v[0xf] = m_Registers.v[ins.GetDst()] > m_Registers.v[ins.GetSrc()];
+        m_Registers.v[ins.GetDst()] = m_Registers.v[ins.GetDst()] - m_Registers.v[ins.GetSrc()];
         break;
     case Instruction::Type::SHR:
-        m_Registers.v[0xf] = m_Registers.v[ins.dst] & 0x1;
-        m_Registers.v[ins.dst] >>= 2;
+        m_Registers.v[0xf] = m_Registers.v[ins.GetDst()] & 0x1;
+        m_Registers.v[ins.GetDst()] >>= 2;
         break;
     case Instruction::Type::SUBN:
-        m_Registers.v[0xf] = m_Registers.v[ins.src] > m_Registers.v[ins.dst];
-        m_Registers.v[ins.dst] = m_Registers.v[ins.src] - m_Registers.v[ins.dst];
+        m_Registers.v[0xf] = m_Registers.v[ins.GetSrc()] > m_Registers.v[ins.GetDst()];
+        m_Registers.v[ins.GetDst()] = m_Registers.v[ins.GetSrc()] - m_Registers.v[ins.GetDst()];
         break;
     case Instruction::Type::SHL:
-        m_Registers.v[0xf] = !!(m_Registers.v[ins.dst] & 0x80);
-        m_Registers.v[ins.dst] <<= 2;
+        m_Registers.v[0xf] = !!(m_Registers.v[ins.GetDst()] & 0x80);
+        m_Registers.v[ins.GetDst()] <<= 2;
         break;
     case Instruction::Type::RND:
-        m_Registers.v[ins.dst] = (rand() % 255) & ins.byte;
+        m_Registers.v[ins.GetDst()] = (NextRandom() % 255) & ins.GetByte();
         break;
     case Instruction::Type::DRW:
-        m_Registers.v[0xF] = DrawSprite(m_Registers.v[ins.dst],
-            m_Registers.v[ins.src],
+        m_Registers.v[0xF] = DrawSprite(m_Registers.v[ins.GetDst()],
+            m_Registers.v[ins.GetSrc()],
             m_Registers.i,
-            ins.byte & 0x0F);
+            ins.GetByte() & 0x0F);
         break;
     case Instruction::Type::SKP:
-        if (m_KeyStates & (1 << m_Registers.v[ins.dst]))
+        if (m_KeyStates & (1 << m_Registers.v[ins.GetDst()]))
             pcInc = 4;
         break;
     case Instruction::Type::SKNP:
-        if ((m_KeyStates & (1 << m_Registers.v[ins.dst])) == 0)
+        if ((m_KeyStates & (1 << m_Registers.v[ins.GetDst()])) == 0)
             pcInc = 4;
         break;
     case Instruction::Type::LD_F_V:
-        m_Registers.i = (m_Registers.v[ins.dst] & 0xF) * 5;
+        m_Registers.i = (m_Registers.v[ins.GetDst()] & 0xF) * 5;
         break;
     case Instruction::Type::LD_B_V:
     {
-        WriteByte(m_Registers.i + 0, m_Registers.v[ins.dst] / 100);
-        WriteByte(m_Registers.i + 1, (m_Registers.v[ins.dst] / 10) % 10);
-        WriteByte(m_Registers.i + 2, m_Registers.v[ins.dst] % 10);
+        WriteByte(m_Registers.i + 0, m_Registers.v[ins.GetDst()] / 100);
+        WriteByte(m_Registers.i + 1, (m_Registers.v[ins.GetDst()] / 10) % 10);
+        WriteByte(m_Registers.i + 2, m_Registers.v[ins.GetDst()] % 10);
         break;
     }
     case Instruction::Type::LD_I_IMM:
-        m_Registers.i = ins.address;
+        m_Registers.i = ins.GetAddress();
         break;
     case Instruction::Type::LD_I_V0V:
     {
@@ -144,7 +145,7 @@ void Core::DoCycle()
         int d = m_Registers.i;
         do {
             WriteByte(d++, m_Registers.v[i]);
-        } while (i++ < ins.dst);
+        } while (i++ < ins.GetDst());
         break;
     }
     case Instruction::Type::LD_V0V_I:
@@ -153,63 +154,245 @@ void Core::DoCycle()
         int d = m_Registers.i;
         do {
             m_Registers.v[i] = ReadByte(d++);
-        } while (i++ < ins.dst);
+        } while (i++ < ins.GetDst());
         break;
     }
     case Instruction::Type::LD_V_DT:
-        m_Registers.v[ins.dst] = m_Registers.dt;
+        m_Registers.v[ins.GetDst()] = m_Registers.dt;
         break;
     case Instruction::Type::LD_V_K:
-        m_KeyDst = ins.dst;
+        m_KeyDst = ins.GetDst();
         m_WaitingForKey = true;
         break;
     case Instruction::Type::LD_DT_V:
-        m_Registers.dt = m_Registers.v[ins.dst];
+        m_Registers.dt = m_Registers.v[ins.GetDst()];
         break;
     case Instruction::Type::LD_ST_V:
-        m_Registers.st = m_Registers.v[ins.dst];
+    case Instruction::Type::LD_AUDIO_I:
+    case Instruction::Type::LD_PITCH_V:
+        ExecuteAudio(ins, m_Cycles);
         break;
     case Instruction::Type::ADD_I_V:
-        m_Registers.i += m_Registers.v[ins.dst];
+        m_Registers.i += m_Registers.v[ins.GetDst()];
         break;
     default:
         break;
     }
 
     m_Registers.ip += pcInc;
+    ++m_Cycles;
     return;
 }
 
+/**
+ * Execute an instruction that changes the sound and tell the audio listener.
+ * LD ST only produces an event when it turns the tone on or off.
+ * @param ins   Instruction
+ * @param cycle Cycle the instruction executes on
+ */
+void Core::ExecuteAudio(const Instruction& ins, uint64_t cycle)
+{
+    AudioEvent event{ cycle };
+
+    switch (ins.type)
+    {
+    case Instruction::Type::LD_ST_V:
+    {
+        bool wasOn = m_Registers.st != 0;
+
+        m_Registers.st = m_Registers.v[ins.GetDst()];
+        if (wasOn == (m_Registers.st != 0))
+            return;
+        event.kind = wasOn ? AudioEvent::Kind::ToneOff : AudioEvent::Kind::ToneOn;
+        break;
+    }
+    case Instruction::Type::LD_AUDIO_I:
+        event.kind = AudioEvent::Kind::Pattern;
+        for (int i = 0; i < 16; i++)
+            event.pattern[i] = ReadByte(m_Registers.i + i);
+        break;
+    case Instruction::Type::LD_PITCH_V:
+        event.kind = AudioEvent::Kind::Pitch;
+        event.pitch = m_Registers.v[ins.GetDst()];
+        break;
+    default:
+        return;
+    }
+
+    if (m_AudioListener)
+        m_AudioListener->OnAudioEvent(event);
+}
+
+/**
+ * Run the core for a number of cycles, applying each queued key event right
+ * before the cycle it is stamped with. Cycles spent waiting for a key still
+ * count, so the emulated time keeps moving.
+ * @param cycles Number of cycles to run
+ * @return Number of cycles run
+ */
+int Core::RunCycles(int cycles)
+{
+    int executed = 0;
+
+    while (executed < cycles)
+    {
+        ApplyInput();
+        if (m_WaitingForKey)
+        {
+            /* Nothing can change until the next key event */
+            uint64_t idle = std::min<uint64_t>(cycles - executed, GetNextInputCycle() - m_Cycles);
+            m_Cycles += idle;
+            executed += static_cast<int>(idle);
+        }
+        else
+        {
+            DoCycle();
+            executed++;
+        }
+    }
+    return executed;
+}
+
+/**
+ * Queue a key event to be applied at a given cycle. Events stay in the order
+ * they were queued in, and an event stamped in the past is applied before
+ * the next cycle. A full queue refuses the event rather than applying one
+ * early, so every event that is queued takes effect on the cycle returned.
+ * @param cycle Cycle the event takes effect on
+ * @param key   Key, 0 to 15
+ * @param down  True if the key was pressed, false if it was released
+ * @return Cycle the event was queued at, or UINT64_MAX if the queue is full
+ */
+uint64_t Core::QueueKey(uint64_t cycle, uint8_t key, bool down)
+{
+    if (m_InputQueue.IsFull())
+        return UINT64_MAX;
+
+    cycle = std::max(cycle, m_Cycles);
+    if (!m_InputQueue.IsEmpty())
+        cycle = std::max(cycle, m_InputQueue.Back().cycle);
+    m_InputQueue.Push({ cycle, static_cast<uint8_t>(key & 0xF), down });
+    return cycle;
+}
+
+void Core::ApplyInput()
+{
+    while (!m_InputQueue.IsEmpty() && m_InputQueue.Front().cycle <= m_Cycles)
+    {
+        ApplyKey(m_InputQueue.Front());
+        m_InputQueue.Pop();
+    }
+}
+
+void Core::ApplyKey(const InputEvent& event)
+{
+    if (event.down)
+        KeyDown(event.key);
+    else
+        KeyUp(event.key);
+}
+
 void Core::LoadData(const uint8_t* data, size_t length, uint16_t memoryOffset)
 {
-    if ((length + memoryOffset) > sizeof(m_Memory))
-        length = sizeof(m_Memory) - memoryOffset;
+    memoryOffset &= AddressMask;
+    if ((length + memoryOffset) > MemorySize)
+        length = MemorySize - memoryOffset;
     memcpy(m_Memory.data() + memoryOffset, data, length);
+    m_Memory[MemorySize] = m_Memory[0];
+    if (length != 0)
+        MarkDirty(memoryOffset, length);
 }
 
-bool Core::UpdateDisplay()
+static_assert(std::is_trivially_copyable_v<Core>);
+static_assert(std::is_trivially_copyable_v<CoreSnapshot>);
+static_assert(sizeof(CoreSnapshot::memory) == Core::MemorySize);
+static_assert(sizeof(CoreSnapshot::display) == Core::DisplayBitmapSize);
+static_assert(offsetof(CoreSnapshot, cycles) == 80 && sizeof(CoreSnapshot) == 4440);
+
+/**
+ * Copy the state of the core into a snapshot
+ * @param snapshot Snapshot to fill, which can be reused from an earlier save
+ */
+void Core::SaveState(CoreSnapshot& snapshot) const
+{
+    snapshot.magic = CoreSnapshot::Magic;
+    snapshot.version = CoreSnapshot::Version;
+    snapshot.size = static_cast<uint16_t>(sizeof(CoreSnapshot));
+    memcpy(snapshot.v, m_Registers.v, sizeof(snapshot.v));
+    snapshot.dt = m_Registers.dt;
+    snapshot.st = m_Registers.st;
+    snapshot.i = m_Registers.i;
+    snapshot.ip = m_Registers.ip;
+    snapshot.sp = m_Registers.sp;
+    snapshot.keyDst = m_KeyDst;
+    memcpy(snapshot.stack, m_Registers.stack, sizeof(snapshot.stack));
+    snapshot.keyStates = m_KeyStates;
+    snapshot.randomState = m_RandomState;
+    snapshot.waitingForKey = m_WaitingForKey;
+    memset(snapshot.reserved, 0, sizeof(snapshot.reserved));
+    snapshot.cycles = m_Cycles;
+    memcpy(snapshot.memory, m_Memory.data(), MemorySize);
+    memcpy(snapshot.display, m_DisplayBitmap.data(), DisplayBitmapSize);
+}
+
+/**
+ * Restore the core from a snapshot. Queued key events belong to the time
+ * line being left and are dropped.
+ * @param snapshot Snapshot taken by SaveState
+ * @return True on success, false if the snapshot is from another version
+ */
+bool Core::LoadState(const CoreSnapshot& snapshot)
 {
-    if (m_DisplayDirty)
+    if (snapshot.magic != CoreSnapshot::Magic || snapshot.version != CoreSnapshot::Version
+        || snapshot.size != sizeof(CoreSnapshot))
+        return false;
+
+    bool toneWasOn = m_Registers.st != 0;
+
+    memcpy(m_Registers.v, snapshot.v, sizeof(snapshot.v));
+    m_Registers.dt = snapshot.dt;
+    m_Registers.st = snapshot.st;
+    m_Registers.i = snapshot.i;
+    m_Registers.ip = snapshot.ip;
+    m_Registers.sp = snapshot.sp;
+    m_KeyDst = snapshot.keyDst & 0xF;
+    memcpy(m_Registers.stack, snapshot.stack, sizeof(snapshot.stack));
+    m_KeyStates = snapshot.keyStates;
+    m_RandomState = snapshot.randomState ? snapshot.randomState : 1;
+    m_WaitingForKey = snapshot.waitingForKey != 0;
+    m_Cycles = snapshot.cycles;
+
+    /* Only lines that differ count as written, so views of memory that did not change stay valid */
+    for (int page = 0; page < MemoryPages; page++)
     {
-        for (int i = 0; i < DisplayWidth * DisplayHeight; i++)
+        uint8_t* current = m_Memory.data() + page * MemoryPageSize;
+        const uint8_t* saved = snapshot.memory + page * MemoryPageSize;
+
+        if (memcmp(current, saved, MemoryPageSize) == 0)
+            continue;
+
+        for (int offset = 0; offset < MemoryPageSize; offset += MemoryLineSize)
         {
-            int pixel = i * 4;
-            int bit = 1 << (i % 8);
-            int byte = i / 8;
-            int color = 0;
-
-            if (m_DisplayBitmap[byte] & bit)
-                color = 255;
-
-            m_DisplayBuffer[pixel] = color;
-            m_DisplayBuffer[pixel + 1] = color;
-            m_DisplayBuffer[pixel + 2] = color;
-            m_DisplayBuffer[pixel + 3] = 255;
+            if (memcmp(current + offset, saved + offset, MemoryLineSize) != 0)
+                m_DirtyLines.set((page * MemoryPageSize + offset) / MemoryLineSize);
         }
-        m_DisplayDirty = false;
-        return true;
+        memcpy(current, saved, MemoryPageSize);
+        ++m_PageGenerations[page];
+        ++m_MemoryGeneration;
     }
-    return false;
+    m_Memory[MemorySize] = m_Memory[0];
+
+    if (memcmp(m_DisplayBitmap.data(), snapshot.display, DisplayBitmapSize) != 0)
+    {
+        memcpy(m_DisplayBitmap.data(), snapshot.display, DisplayBitmapSize);
+        m_DisplayDirty = true;
+    }
+
+    m_InputQueue.Clear();
+
+    if (m_AudioListener && toneWasOn != (m_Registers.st != 0))
+        m_AudioListener->OnAudioEvent({ m_Cycles, m_Registers.st ? AudioEvent::Kind::ToneOn : AudioEvent::Kind::ToneOff });
+    return true;
 }
 
 bool Core::DrawSprite(int x, int y, int address, int length)
@@ -3,28 +3,159 @@
 #pragma once
 
 #include <cstddef>
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <array>
+#include <bit>
+#include <bitset>
 #include <vector>
 #include <string>
 
+/* Reverse the bytes of a 16-bit value, a single instruction on every compiler we build with */
+inline uint16_t ByteSwap16(uint16_t v)
+{
+#if defined(_MSC_VER)
+    return _byteswap_ushort(v);
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap16(v);
+#else
+    return static_cast<uint16_t>((v << 8) | (v >> 8));
+#endif
+}
+
+struct Instruction;
+
+/* A change to the sound output, stamped with the cycle of the instruction or timer tick that caused it */
+struct AudioEvent
+{
+    enum class Kind : uint8_t
+    {
+        ToneOn,
+        ToneOff,
+        Pattern,    // XO-CHIP pattern buffer, 128 one-bit samples
+        Pitch,      // XO-CHIP playback rate of the pattern
+    };
+
+    uint64_t cycle;
+    Kind     kind;
+    uint8_t  pitch;
+    uint8_t  pattern[16];
+};
+
+/* A key press or release, applied before the instruction at the given cycle */
+struct InputEvent
+{
+    uint64_t cycle;
+    uint8_t  key;
+    bool     down;
+};
+
+/* Key events waiting for their cycle, in a fixed ring so a Core stays trivially copyable */
+class InputQueue
+{
+public:
+    constexpr static int Capacity = 32;
+
+    bool IsEmpty() const { return m_Count == 0; }
+    bool IsFull() const { return m_Count == Capacity; }
+    const InputEvent& Front() const { return m_Events[m_Head]; }
+    const InputEvent& Back() const { return m_Events[(m_Head + m_Count - 1) % Capacity]; }
+
+    void Push(const InputEvent& event)
+    {
+        m_Events[(m_Head + m_Count) % Capacity] = event;
+        m_Count++;
+    }
+
+    void Pop()
+    {
+        m_Head = (m_Head + 1) % Capacity;
+        m_Count--;
+    }
+
+    void Clear()
+    {
+        m_Head = 0;
+        m_Count = 0;
+    }
+private:
+    std::array<InputEvent, Capacity> m_Events{ };
+    uint8_t m_Head = 0;
+    uint8_t m_Count = 0;
+};
+
+/**
+ * Everything that makes up the state of a core, in a fixed layout that can
+ * be copied as a whole. The RGBA display buffer is left out because it is
+ * rebuilt from the bitmap. Any change to the layout must bump Version.
+ */
+struct CoreSnapshot
+{
+    constexpr static uint32_t Magic = 0x53533843; // "C8SS"
+    constexpr static uint16_t Version = 1;
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint8_t  v[16];
+    uint8_t  dt;
+    uint8_t  st;
+    uint16_t i;
+    uint16_t ip;
+    uint8_t  sp;
+    uint8_t  keyDst;
+    uint16_t stack[16];
+    uint32_t keyStates;
+    uint32_t randomState;
+    uint8_t  waitingForKey;
+    uint8_t  reserved[7];
+    uint64_t cycles;
+    uint8_t  memory[4096];
+    uint8_t  display[256];
+};
+
+/* Receives audio events on the thread running the core */
+class AudioListener
+{
+public:
+    virtual ~AudioListener() = default;
+    virtual void OnAudioEvent(const AudioEvent& event) = 0;
+};
+
 class Core
 {
 public:
     constexpr static int MemorySize = 4096;
+    constexpr static int MemoryLineSize = 16;
+    constexpr static int MemoryLines = MemorySize / MemoryLineSize;
+    constexpr static int MemoryPageSize = 256;
+    constexpr static int MemoryPages = MemorySize / MemoryPageSize;
+    constexpr static uint16_t AddressMask = MemorySize - 1;
     constexpr static int DisplayWidth = 64;
     constexpr static int DisplayHeight = 32;
     constexpr static int DisplayBitmapSize = (DisplayWidth * DisplayHeight) / 8;
 
     Core();
-    ~Core();
 
     void DoCycle();
+    int RunCycles(int cycles);
     void LoadData(const uint8_t* data, size_t length, uint16_t memoryOffset);
     void LoadData(const std::vector<uint8_t>& data, uint16_t memoryOffset) { return LoadData(data.data(), data.size(), memoryOffset); }
 
-    bool UpdateDisplay();
-    const auto& GetDisplayBuffer() { return m_DisplayBuffer; }
+    void SaveState(CoreSnapshot& snapshot) const;
+    bool LoadState(const CoreSnapshot& snapshot);
+
+    /* True if the display bitmap changed since the last call */
+    bool TakeDisplayChange()
+    {
+        bool changed = m_DisplayDirty;
+        m_DisplayDirty = false;
+        return changed;
+    }
+
+    const auto& GetDisplayBitmap() const { return m_DisplayBitmap; }
 
     void SetIP(uint16_t address) { m_Registers.ip = address; }
     uint16_t GetIP() const { return m_Registers.ip; }
@@ -50,41 +181,82 @@ public:
         m_KeyStates &= ~(1 << key);
     }
 
-    void DecrementDT()
+    /* Called at 60Hz, the sound stops when the sound timer reaches zero */
+    void TickTimers()
     {
         if (m_Registers.dt)
             --m_Registers.dt;
+        if (m_Registers.st && --m_Registers.st == 0 && m_AudioListener)
+            m_AudioListener->OnAudioEvent({ m_Cycles, AudioEvent::Kind::ToneOff });
     }
 
+    /* Number of cycles run since the core was created, including cycles spent waiting for a key */
+    uint64_t GetCycles() const { return m_Cycles; }
+
+    void SetAudioListener(AudioListener* listener) { m_AudioListener = listener; }
+
+    /* RND is driven by a generator owned by the core, so a run can be reproduced from its seed */
+    void SetRandomSeed(uint32_t seed) { m_RandomState = seed ? seed : 1; }
+
     bool WaitingForKey() const { return m_WaitingForKey; }
 
+    uint64_t QueueKey(uint64_t cycle, uint8_t key, bool down);
+
+    /* LoadState drops queued key events, callers that come back to the same time line put them back */
+    const InputQueue& GetInputQueue() const { return m_InputQueue; }
+    void SetInputQueue(const InputQueue& queue) { m_InputQueue = queue; }
+
+    /* Cycle of the next queued key event, or UINT64_MAX if there is none */
+    uint64_t GetNextInputCycle() const { return m_InputQueue.IsEmpty() ? UINT64_MAX : m_InputQueue.Front().cycle; }
+
+    /* One bit per 16-byte memory line, set whenever the line is written */
+    const std::bitset<MemoryLines>& GetDirtyLines() const { return m_DirtyLines; }
+    void ClearDirtyLines() { m_DirtyLines.reset(); }
+
+    /* Incremented on every write to a 256-byte page, so cached views of a page can tell when it changed */
+    uint32_t GetPageGeneration(int page) const { return m_PageGenerations[page]; }
+
+    /* Incremented on every write to memory */
+    uint32_t GetMemoryGeneration() const { return m_MemoryGeneration; }
+
+    /* Addresses wrap around at 4KB like on the original hardware */
     uint8_t ReadByte(uint16_t address) const
     {
-        if (address < sizeof(m_Memory))
-            return m_Memory[address];
-        return 0;
+        return m_Memory[address & AddressMask];
     }
 
+    /* The guard byte mirrors address 0, so a word at 0xFFF wraps without a branch */
     uint16_t ReadWord(uint16_t address) const
     {
-        if (address < sizeof(m_Memory))
-            return _byteswap_ushort(*(const uint16_t*)(m_Memory.data() + address));
-        return 0;
+        uint16_t word;
+
+        memcpy(&word, m_Memory.data() + (address & AddressMask), sizeof(word));
+        if constexpr (std::endian::native == std::endian::little)
+            word = ByteSwap16(word);
+        return word;
     }
 
     void WriteWord(uint16_t address, uint16_t v)
     {
-        if (address < sizeof(m_Memory))
-            *(uint16_t*)(m_Memory.data() + address) = _byteswap_ushort(v);
+        WriteByte(address, v >> 8);
+        WriteByte(address + 1, v & 0xFF);
     }
 
     void WriteByte(uint16_t address, uint8_t v)
     {
-        if (address < sizeof(m_Memory))
-            m_Memory[address] = v;
+        address &= AddressMask;
+        m_Memory[address] = v;
+        m_Memory[MemorySize] = m_Memory[0];
+        m_DirtyLines.set(address / MemoryLineSize);
+        ++m_PageGenerations[address / MemoryPageSize];
+        ++m_MemoryGeneration;
     }
 
 private:
+    friend class NativeProgram;
+    friend class Debugger;
+    friend class Tracer;
+
     constexpr static std::array<uint8_t, 5 * 16> s_CharSprites = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
         0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -114,13 +286,29 @@ private:
         uint16_t stack[16];
     } m_Registers;
 
-    std::array<uint8_t, MemorySize> m_Memory;
+    std::array<uint8_t, MemorySize + 1> m_Memory; // Followed by a copy of address 0
     std::array<uint8_t, DisplayBitmapSize> m_DisplayBitmap;
-    std::array<uint8_t, DisplayWidth* DisplayHeight * 4> m_DisplayBuffer;
+    std::bitset<MemoryLines> m_DirtyLines;
+    std::array<uint32_t, MemoryPages> m_PageGenerations;
+    uint32_t m_MemoryGeneration;
     bool m_DisplayDirty;
     bool m_WaitingForKey;
     uint8_t  m_KeyDst;
     uint32_t m_KeyStates;
+    uint64_t m_Cycles;
+    AudioListener* m_AudioListener;
+    InputQueue m_InputQueue;
+    uint32_t m_RandomState;
+
+    void MarkDirty(size_t address, size_t length)
+    {
+        size_t last = std::min<size_t>(address + length - 1, MemorySize - 1);
+        for (size_t line = address / MemoryLineSize; line <= last / MemoryLineSize; line++)
+            m_DirtyLines.set(line);
+        for (size_t page = address / MemoryPageSize; page <= last / MemoryPageSize; page++)
+            ++m_PageGenerations[page];
+        ++m_MemoryGeneration;
+    }
 
     bool GetPixel(int x, int y)
     {
@@ -144,5 +332,18 @@ private:
         return ret;
     }
 
+    void ApplyInput();
+    void ApplyKey(const InputEvent& event);
+
+    /* xorshift32 */
+    uint32_t NextRandom()
+    {
+        m_RandomState ^= m_RandomState << 13;
+        m_RandomState ^= m_RandomState >> 17;
+        m_RandomState ^= m_RandomState << 5;
+        return m_RandomState;
+    }
+
     bool DrawSprite(int x, int y, int address, int length);
+    void ExecuteAudio(const Instruction& ins, uint64_t cycle);
 };
\ No newline at end of file
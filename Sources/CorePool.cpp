@@ -0,0 +1,48 @@
+#include <new>
+#include "CorePool.h"
+
+/**
+ * Copy a core. The copy has no audio listener, so it can run without
+ * sounding on the host.
+ * @param core Core to copy
+ * @return The copy, which must be given back with Release
+ */
+Core* CorePool::Fork(const Core& core)
+{
+    if (m_Free == nullptr)
+        Grow();
+
+    Slot* slot = m_Free;
+    m_Free = slot->next;
+    m_Live++;
+
+    Core* copy = new (slot->storage) Core(core);
+    copy->SetAudioListener(nullptr);
+    return copy;
+}
+
+/**
+ * Give back a core returned by Fork
+ * @param core Core to release
+ */
+void CorePool::Release(Core* core)
+{
+    /* Core is trivially copyable, so there is nothing to destroy */
+    Slot* slot = reinterpret_cast<Slot*>(core);
+
+    slot->next = m_Free;
+    m_Free = slot;
+    m_Live--;
+}
+
+void CorePool::Grow()
+{
+    m_Slabs.push_back(std::make_unique<Slot[]>(SlabSize));
+
+    Slot* slab = m_Slabs.back().get();
+    for (size_t i = 0; i < SlabSize; i++)
+    {
+        slab[i].next = m_Free;
+        m_Free = &slab[i];
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "Core.h"
+
+/**
+ * Allocator for copies of a core, for searching the outcomes of different
+ * inputs from one state. Cores are carved from slabs and released slots go
+ * on a free list, so forking and releasing never touch the heap once the
+ * pool has grown to the size of the search.
+ */
+class CorePool
+{
+public:
+    constexpr static size_t SlabSize = 256;
+
+    CorePool() = default;
+    CorePool(const CorePool&) = delete;
+    CorePool& operator=(const CorePool&) = delete;
+
+    Core* Fork(const Core& core);
+    void Release(Core* core);
+
+    size_t GetLiveCount() const { return m_Live; }
+    size_t GetCapacity() const { return m_Slabs.size() * SlabSize; }
+private:
+    union Slot
+    {
+        Slot* next;
+        alignas(Core) unsigned char storage[sizeof(Core)];
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> m_Slabs;
+    Slot* m_Free = nullptr;
+    size_t m_Live = 0;
+
+    void Grow();
+};
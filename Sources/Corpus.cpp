@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Corpus.h"
+#include "CodeMap.h"
+#include "Disassembler.h"
+#include "MappedFile.h"
+
+namespace fs = std::filesystem;
+
+/* Opcode frequencies, indexed by instruction type and encoding */
+static constexpr size_t EncodingCount = static_cast<size_t>(Instruction::Encoding::DestinationSourceNibble) + 1;
+using OpcodeHistogram = std::array<std::array<uint64_t, EncodingCount>, static_cast<size_t>(Instruction::Type::_END)>;
+
+static const char* s_OpcodeForms[] = {
+    "???",
+    "CLS",
+    "RET",
+    "JP addr",
+    "JP V0, addr",
+    "CALL addr",
+    "SE Vx, ",
+    "SNE Vx, ",
+    "LD Vx, ",
+    "ADD Vx, ",
+    "OR Vx, Vy",
+    "AND Vx, Vy",
+    "XOR Vx, Vy",
+    "SUB Vx, Vy",
+    "SHR Vx",
+    "SUBN Vx, Vy",
+    "SHL Vx",
+    "RND Vx, byte",
+    "DRW Vx, Vy, nibble",
+    "SKP Vx",
+    "SKNP Vx",
+    "LD F, Vx",
+    "LD B, Vx",
+    "LD I, addr",
+    "LD [I], Vx",
+    "LD Vx, [I]",
+    "LD Vx, DT",
+    "LD Vx, K",
+    "LD DT, Vx",
+    "LD ST, Vx",
+    "ADD I, Vx"
+};
+
+struct RomSummary
+{
+    fs::path path;
+    size_t   size;
+    size_t   codeBytes;
+    bool     ok;
+};
+
+/**
+ * Writes finished listings on its own thread so workers never block on disk
+ */
+class ListingWriter
+{
+public:
+    ListingWriter()
+        : m_Closed(false), m_Failed(false), m_Thread(&ListingWriter::Run, this)
+    { }
+
+    ~ListingWriter()
+    {
+        Close();
+    }
+
+    void Push(fs::path path, std::string text)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Queue.push_back({ std::move(path), std::move(text) });
+        }
+        m_Signal.notify_one();
+    }
+
+    /* Flush everything that was pushed and stop the thread */
+    bool Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Closed = true;
+        }
+        m_Signal.notify_one();
+
+        if (m_Thread.joinable())
+            m_Thread.join();
+        return !m_Failed;
+    }
+private:
+    struct Item
+    {
+        fs::path    path;
+        std::string text;
+    };
+
+    std::mutex              m_Mutex;
+    std::condition_variable m_Signal;
+    std::deque<Item>        m_Queue;
+    bool                    m_Closed;
+    std::atomic<bool>       m_Failed;
+    std::thread             m_Thread;
+
+    void Run()
+    {
+        std::deque<Item> batch;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Signal.wait(lock, [this] { return m_Closed || !m_Queue.empty(); });
+                if (m_Queue.empty())
+                    return;
+                batch.swap(m_Queue);
+            }
+
+            /* Write outside the lock so pushes never wait on the disk */
+            for (Item& item : batch)
+            {
+                std::error_code error;
+                fs::create_directories(item.path.parent_path(), error);
+
+                std::ofstream output(item.path, std::ios::binary | std::ios::out);
+                output.write(item.text.data(), item.text.size());
+                if (!output)
+                {
+                    printf("ERROR: failed to write '%s'\n", item.path.string().c_str());
+                    m_Failed = true;
+                }
+            }
+            batch.clear();
+        }
+    }
+};
+
+static bool IsRom(const fs::directory_entry& entry)
+{
+    std::string extension = entry.path().extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return entry.is_regular_file() && extension == ".ch8";
+}
+
+static std::string FormatOpcode(size_t type, size_t encoding)
+{
+    std::string form = s_OpcodeForms[type];
+
+    if (form.back() == ' ')
+    {
+        if (encoding == static_cast<size_t>(Instruction::Encoding::DestinationByte))
+            form += "byte";
+        else
+            form += "Vy";
+    }
+    return form;
+}
+
+static bool WriteIndex(const fs::path& path, const std::vector<RomSummary>& roms, const OpcodeHistogram& histogram)
+{
+    std::vector<std::pair<uint64_t, std::string>> opcodes;
+    uint64_t total = 0;
+    FILE* file = fopen(path.string().c_str(), "w");
+
+    if (file == nullptr)
+        return false;
+
+    for (size_t type = 0; type < histogram.size(); type++)
+    {
+        for (size_t encoding = 0; encoding < EncodingCount; encoding++)
+        {
+            if (histogram[type][encoding] == 0)
+                continue;
+            opcodes.emplace_back(histogram[type][encoding], FormatOpcode(type, encoding));
+            total += histogram[type][encoding];
+        }
+    }
+    std::sort(opcodes.begin(), opcodes.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    fprintf(file, "; %zu ROMs, %llu reachable instructions\n\n", roms.size(), static_cast<unsigned long long>(total));
+    for (const auto& [count, form] : opcodes)
+        fprintf(file, "%-20s %10llu %6.2f%%\n", form.c_str(), static_cast<unsigned long long>(count), 100.0 * count / total);
+
+    fprintf(file, "\n; ROM, size, code bytes\n");
+    for (const RomSummary& rom : roms)
+    {
+        if (rom.ok)
+            fprintf(file, "%s %zu %zu\n", rom.path.generic_string().c_str(), rom.size, rom.codeBytes);
+        else
+            fprintf(file, "%s failed\n", rom.path.generic_string().c_str());
+    }
+
+    fclose(file);
+    return true;
+}
+
+/**
+ * Disassemble every .ch8 file under a directory. Files are memory-mapped and
+ * spread over a pool of worker threads, finished listings are handed to a
+ * writer thread, and opcode counts are merged once all workers are done.
+ * @param romDirectory    Directory to search for ROMs, recursively
+ * @param outputDirectory Receives one .asm listing per ROM plus opcodes.txt
+ * @param threadCount     Number of workers, 0 to use one per hardware thread
+ * @return True if every ROM was disassembled and written
+ */
+bool DisassembleCorpus(const fs::path& romDirectory, const fs::path& outputDirectory, unsigned threadCount)
+{
+    std::vector<RomSummary> roms;
+    std::error_code error;
+
+    for (auto it = fs::recursive_directory_iterator(romDirectory, error); it != fs::recursive_directory_iterator(); it.increment(error))
+    {
+        if (error)
+            break;
+        if (IsRom(*it))
+            roms.push_back({ fs::relative(it->path(), romDirectory), 0, 0, false });
+    }
+
+    if (error)
+    {
+        printf("ERROR: failed to read '%s': %s\n", romDirectory.string().c_str(), error.message().c_str());
+        return false;
+    }
+
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min<unsigned>(threadCount, std::max<size_t>(roms.size(), 1));
+
+    std::vector<OpcodeHistogram> histograms(threadCount, OpcodeHistogram{ });
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next = 0;
+    ListingWriter writer;
+
+    for (unsigned t = 0; t < threadCount; t++)
+    {
+        workers.emplace_back([&, t] {
+            OpcodeHistogram& histogram = histograms[t];
+
+            for (size_t index = next++; index < roms.size(); index = next++)
+            {
+                RomSummary& rom = roms[index];
+                MappedFile file(romDirectory / rom.path);
+
+                if (!file.IsOpen())
+                {
+                    printf("ERROR: failed to map '%s'\n", rom.path.string().c_str());
+                    continue;
+                }
+
+                const uint8_t* code = file.GetData();
+                CodeMap map(code, file.GetSize(), 0x200);
+
+                for (const auto& [start, block] : map.GetBlocks())
+                {
+                    for (int ip = block.start; ip < block.end; ip += 2)
+                    {
+                        Instruction ins((code[ip - 0x200] << 8) | code[ip - 0x200 + 1]);
+                        ++histogram[static_cast<size_t>(ins.type)][static_cast<size_t>(ins.encoding)];
+                        rom.codeBytes += 2;
+                    }
+                }
+
+                rom.size = file.GetSize();
+                rom.ok = true;
+
+                fs::path listing = outputDirectory / rom.path;
+                listing.replace_extension(".asm");
+                writer.Push(std::move(listing), Disassemble(code, file.GetSize(), map));
+            }
+        });
+    }
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    bool ok = writer.Close();
+
+    OpcodeHistogram histogram{ };
+    for (const OpcodeHistogram& partial : histograms)
+    {
+        for (size_t type = 0; type < histogram.size(); type++)
+        {
+            for (size_t encoding = 0; encoding < EncodingCount; encoding++)
+                histogram[type][encoding] += partial[type][encoding];
+        }
+    }
+
+    std::sort(roms.begin(), roms.end(), [](const RomSummary& a, const RomSummary& b) { return a.path < b.path; });
+    fs::create_directories(outputDirectory, error);
+    if (!WriteIndex(outputDirectory / "opcodes.txt", roms, histogram))
+    {
+        printf("ERROR: failed to write '%s'\n", (outputDirectory / "opcodes.txt").string().c_str());
+        return false;
+    }
+
+    return ok && std::all_of(roms.begin(), roms.end(), [](const RomSummary& rom) { return rom.ok; });
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <filesystem>
+
+bool DisassembleCorpus(const std::filesystem::path& romDirectory, const std::filesystem::path& outputDirectory, unsigned threadCount = 0);
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include "Debugger.h"
+#include "Instruction.h"
+
+/**
+ * Find the memory an instruction accesses through I
+ * @param ins    Instruction
+ * @param length Receives the number of bytes accessed
+ * @param write  Receives true if the bytes are written, false if they are read
+ * @return True if the instruction accesses memory
+ */
+static bool GetMemoryAccess(const Instruction& ins, int& length, bool& write)
+{
+    switch (ins.type)
+    {
+    case Instruction::Type::LD_B_V:
+        length = 3;
+        write = true;
+        return true;
+    case Instruction::Type::LD_I_V0V:
+        length = ins.GetDst() + 1;
+        write = true;
+        return true;
+    case Instruction::Type::LD_V0V_I:
+        length = ins.GetDst() + 1;
+        write = false;
+        return true;
+    case Instruction::Type::DRW:
+        length = ins.GetByte() & 0x0F;
+        write = false;
+        return length > 0;
+    case Instruction::Type::LD_AUDIO_I:
+        length = 16;
+        write = false;
+        return true;
+    default:
+        return false;
+    }
+}
+
+Debugger::Debugger()
+    : m_ConditionIndices{ }, m_RegisterWatches(0), m_Stop{ }, m_Resuming(false), m_ResumeIP(0)
+{
+
+}
+
+/**
+ * Set a breakpoint that only stops the core when a condition holds. The
+ * condition is tested right before the instruction runs.
+ * @param address   Address of the instruction
+ * @param condition Compiled condition
+ */
+void Debugger::SetBreakpoint(uint16_t address, const Condition& condition)
+{
+    uint16_t& index = m_ConditionIndices[address & Core::AddressMask];
+
+    m_Breakpoints[address & Core::AddressMask] = true;
+    if (index == 0)
+    {
+        m_Conditions.push_back(condition);
+        index = static_cast<uint16_t>(m_Conditions.size());
+    }
+    else
+        m_Conditions[index - 1] = condition;
+}
+
+/**
+ * Run the core like Core::RunCycles, checking every instruction first. The
+ * run ends early when a breakpoint or watchpoint is hit, with the core right
+ * before the instruction for breakpoints and memory watches and right after
+ * it for register watches. The next call carries on from there.
+ * @param core   Core to run
+ * @param cycles Maximum number of cycles to run
+ * @return Number of cycles run
+ */
+int Debugger::Run(Core& core, int cycles)
+{
+    int executed = 0;
+
+    m_Stop = { };
+    while (executed < cycles)
+    {
+        core.ApplyInput();
+        if (core.m_WaitingForKey)
+        {
+            uint64_t idle = std::min<uint64_t>(cycles - executed, core.GetNextInputCycle() - core.m_Cycles);
+            core.m_Cycles += idle;
+            executed += static_cast<int>(idle);
+            continue;
+        }
+
+        uint16_t ip = core.GetIP();
+        bool resuming = m_Resuming && ip == m_ResumeIP;
+
+        m_Resuming = false;
+        if (!resuming && CheckBefore(core))
+        {
+            m_Resuming = true;
+            m_ResumeIP = ip;
+            break;
+        }
+
+        uint8_t v[16];
+        uint16_t i = core.GetI();
+        for (int r = 0; r < 16; r++)
+            v[r] = core.GetV(r);
+
+        core.DoCycle();
+        executed++;
+
+        if (m_RegisterWatches && CheckAfter(core, ip, v, i))
+            break;
+    }
+    return executed;
+}
+
+/**
+ * Run a single instruction, even one a breakpoint stopped the core before
+ * @param core Core to run
+ * @return Number of cycles run
+ */
+int Debugger::Step(Core& core)
+{
+    m_Resuming = true;
+    m_ResumeIP = core.GetIP();
+    return Run(core, 1);
+}
+
+bool Debugger::CheckBefore(const Core& core)
+{
+    uint16_t ip = core.GetIP();
+    int length;
+    bool write;
+
+    uint16_t index = m_ConditionIndices[ip & Core::AddressMask];
+    if (m_Breakpoints[ip & Core::AddressMask] && (index == 0 || m_Conditions[index - 1].Evaluate(core)))
+    {
+        m_Stop = { DebugStop::Reason::Breakpoint, ip };
+        return true;
+    }
+
+    Instruction ins(core.ReadWord(ip));
+    if (!GetMemoryAccess(ins, length, write))
+        return false;
+
+    const auto& watches = write ? m_WriteWatches : m_ReadWatches;
+    for (int offset = 0; offset < length; offset++)
+    {
+        uint16_t address = (core.GetI() + offset) & Core::AddressMask;
+        if (watches[address])
+        {
+            m_Stop = { write ? DebugStop::Reason::Write : DebugStop::Reason::Read, ip, address };
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Debugger::CheckAfter(const Core& core, uint16_t ip, const uint8_t* v, uint16_t i)
+{
+    for (uint8_t r = 0; r < 16; r++)
+    {
+        if ((m_RegisterWatches & (1u << r)) && core.GetV(r) != v[r])
+        {
+            m_Stop = { DebugStop::Reason::Register, ip, 0, r };
+            return true;
+        }
+    }
+
+    if ((m_RegisterWatches & (1u << RegisterI)) && core.GetI() != i)
+    {
+        m_Stop = { DebugStop::Reason::Register, ip, 0, RegisterI };
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <bitset>
+#include <vector>
+#include "Condition.h"
+#include "Core.h"
+
+/* Why and where a Debugger stopped the core */
+struct DebugStop
+{
+    enum class Reason : uint8_t
+    {
+        None,
+        Breakpoint, // Before the instruction at ip
+        Read,       // Before the instruction at ip reads address
+        Write,      // Before the instruction at ip writes address
+        Register    // After the instruction at ip changed reg
+    };
+
+    Reason   reason;
+    uint16_t ip;
+    uint16_t address;
+    uint8_t  reg;       // 0-15 for V0-VF, RegisterI for I
+};
+
+/**
+ * Runs a core one instruction at a time and stops it at breakpoints and
+ * watchpoints. Core itself has no debugging hooks, so the checks only cost
+ * anything while the emulator runs the core through a Debugger.
+ */
+class Debugger
+{
+public:
+    constexpr static uint8_t RegisterI = 16;
+
+    Debugger();
+
+    void SetBreakpoint(uint16_t address, bool enabled = true)
+    {
+        m_Breakpoints[address & Core::AddressMask] = enabled;
+        m_ConditionIndices[address & Core::AddressMask] = 0;
+    }
+
+    void SetBreakpoint(uint16_t address, const Condition& condition);
+    void SetReadWatch(uint16_t address, bool enabled = true) { m_ReadWatches[address & Core::AddressMask] = enabled; }
+    void SetWriteWatch(uint16_t address, bool enabled = true) { m_WriteWatches[address & Core::AddressMask] = enabled; }
+
+    /* Stop after any instruction that changes the register, 0-15 for V0-VF or RegisterI */
+    void SetRegisterWatch(uint8_t reg, bool enabled = true)
+    {
+        m_RegisterWatches = enabled ? (m_RegisterWatches | (1u << reg)) : (m_RegisterWatches & ~(1u << reg));
+    }
+
+    int Run(Core& core, int cycles);
+    int Step(Core& core);
+
+    bool IsStopped() const { return m_Stop.reason != DebugStop::Reason::None; }
+    const DebugStop& GetStop() const { return m_Stop; }
+private:
+    std::bitset<Core::MemorySize> m_Breakpoints;
+    std::bitset<Core::MemorySize> m_ReadWatches;
+    std::bitset<Core::MemorySize> m_WriteWatches;
+    std::array<uint16_t, Core::MemorySize> m_ConditionIndices;    // 1 + index into m_Conditions, 0 if unconditional
+    std::vector<Condition> m_Conditions;
+    uint32_t m_RegisterWatches;
+    DebugStop m_Stop;
+    bool m_Resuming;        // The instruction the core stopped before runs without being checked
+    uint16_t m_ResumeIP;
+
+    bool CheckBefore(const Core& core);
+    bool CheckAfter(const Core& core, uint16_t ip, const uint8_t* v, uint16_t i);
+};
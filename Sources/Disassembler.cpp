@@ -1,128 +1,360 @@
+#include <algorithm>
 #include "Disassembler.h"
 
 static constexpr char s_HexDigits[] = "0123456789ABCDEF";
 
+/* Appends to a caller-provided buffer that is known to be large enough */
+struct LineWriter
+{
+    char* out;
+
+    void Char(char c)
+    {
+        *out++ = c;
+    }
+
+    void String(const char* s)
+    {
+        while (*s != '\0')
+            *out++ = *s++;
+    }
+
+    void String(const std::string& s)
+    {
+        out = std::copy(s.begin(), s.end(), out);
+    }
+
+    void Hex(unsigned value, int digits)
+    {
+        for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4)
+            *out++ = s_HexDigits[(value >> shift) & 0xF];
+    }
+
+    /* Immediates are written as #0xNN */
+    void Immediate(unsigned value, int digits)
+    {
+        String("#0x");
+        Hex(value, digits);
+    }
+
+    void Register(int v)
+    {
+        *out++ = 'V';
+        *out++ = s_HexDigits[v & 0xF];
+    }
+
+    void Decimal(int value)
+    {
+        if (value >= 10)
+            *out++ = '0' + (value / 10);
+        *out++ = '0' + (value % 10);
+    }
+};
+
+/**
+ * Format an instruction's mnemonic and operands
+ * @param out Buffer of at least MaxDisassemblyLineLength characters
+ * @param ins Instruction to format
+ * @return Number of characters written, the buffer is not null-terminated
+ */
+size_t FormatInstruction(char* out, const Instruction& ins)
+{
+    const std::string& name = Instruction::GetName(ins.type);
+    LineWriter w{ out };
+
+    switch (ins.type)
+    {
+    case Instruction::Type::CLS:
+    case Instruction::Type::RET:
+        w.String(name);
+        break;
+    case Instruction::Type::JP:
+    case Instruction::Type::CALL:
+        w.String(name);
+        w.Char(' ');
+        w.Immediate(ins.GetAddress(), 3);
+        break;
+    case Instruction::Type::JP_V0_IMM:
+        w.String("JP V0, ");
+        w.Immediate(ins.GetAddress(), 3);
+        break;
+    case Instruction::Type::SE:
+    case Instruction::Type::SNE:
+    case Instruction::Type::LD:
+    case Instruction::Type::ADD:
+        w.String(name);
+        w.Char(' ');
+        w.Register(ins.GetDst());
+        w.String(", ");
+        if (ins.encoding == Instruction::Encoding::DestinationByte)
+            w.Immediate(ins.GetByte(), 2);
+        else
+            w.Register(ins.GetSrc());
+        break;
+    case Instruction::Type::OR:
+    case Instruction::Type::AND:
+    case Instruction::Type::XOR:
+    case Instruction::Type::SUB:
+    case Instruction::Type::SUBN:
+        w.String(name);
+        w.Char(' ');
+        w.Register(ins.GetDst());
+        w.String(", ");
+        w.Register(ins.GetSrc());
+        break;
+    case Instruction::Type::SHR:
+    case Instruction::Type::SHL:
+    case Instruction::Type::SKP:
+    case Instruction::Type::SKNP:
+        w.String(name);
+        w.Char(' ');
+        w.Register(ins.GetDst());
+        break;
+    case Instruction::Type::RND:
+        w.String("RND ");
+        w.Register(ins.GetDst());
+        w.String(", ");
+        w.Immediate(ins.GetByte(), 2);
+        break;
+    case Instruction::Type::DRW:
+        w.String("DRW ");
+        w.Register(ins.GetDst());
+        w.String(", ");
+        w.Register(ins.GetSrc());
+        w.String(", ");
+        w.Decimal(ins.GetByte() & 0xF);
+        break;
+    case Instruction::Type::LD_F_V:
+        w.String("LD F, ");
+        w.Register(ins.GetDst());
+        break;
+    case Instruction::Type::LD_B_V:
+        w.String("LD B, ");
+        w.Register(ins.GetDst());
+        break;
+    case Instruction::Type::LD_I_IMM:
+        w.String("LD I, ");
+        w.Immediate(ins.GetAddress(), 3);
+        break;
+    case Instruction::Type::LD_I_V0V:
+        w.String("LD [I], ");
+        w.Register(ins.GetDst());
+        break;
+    case Instruction::Type::LD_V0V_I:
+        w.String("LD ");
+        w.Register(ins.GetDst());
+        w.String(", [I]");
+        break;
+    case Instruction::Type::LD_V_DT:
+        w.String("LD ");
+        w.Register(ins.GetDst());
+        w.String(", DT");
+        break;
+    case Instruction::Type::LD_V_K:
+        w.String("LD ");
+        w.Register(ins.GetDst());
+        w.String(", K");
+        break;
+    case Instruction::Type::LD_DT_V:
+        w.String("LD DT, ");
+        w.Register(ins.GetDst());
+        break;
+    case Instruction::Type::LD_ST_V:
+        w.String("LD ST, ");
+        w.Register(ins.GetDst());
+        break;
+    case Instruction::Type::ADD_I_V:
+        w.String("ADD I, ");
+        w.Register(ins.GetDst());
+        break;
+    case Instruction::Type::LD_AUDIO_I:
+        w.String("LD AUDIO, [I]");
+        break;
+    case Instruction::Type::LD_PITCH_V:
+        w.String("LD PITCH, ");
+        w.Register(ins.GetDst());
+        break;
+    default:
+        w.String(".BYTE ");
+        w.Immediate(ins.instruction >> 8, 2);
+        break;
+    }
+
+    return w.out - out;
+}
+
+/**
+ * Decode and format the line starting at code[offset]
+ * @param line   Receives the decoded line, its text points into buffer
+ * @param buffer Buffer of at least MaxDisassemblyLineLength characters
+ * @param code   Code being disassembled
+ * @param length Length of the code in bytes
+ * @param offset Offset of the line in the code
+ * @param origin Address of the first byte of code
+ * @return Number of bytes consumed, 1 for unknown opcodes and a trailing odd byte
+ */
+size_t DisassembleLine(DisassembledLine& line, char* buffer, const uint8_t* code, size_t length, size_t offset, int origin)
+{
+    LineWriter w{ buffer };
+    uint16_t word = static_cast<uint16_t>(code[offset] << 8);
+
+    if (offset + 1 < length)
+        word |= code[offset + 1];
+
+    line.address = static_cast<uint16_t>(origin + offset);
+    line.instruction = Instruction(word);
+    line.size = 2;
+    line.word = word;
+
+    /* Unknown opcodes and a lone trailing byte are emitted one byte at a time */
+    if (line.instruction.type == Instruction::Type::UNKNOWN || offset + 1 >= length)
+    {
+        line.instruction.type = Instruction::Type::UNKNOWN;
+        line.instruction.encoding = Instruction::Encoding::None;
+        line.size = 1;
+        line.word = code[offset];
+    }
+
+    w.String("0x");
+    w.Hex(line.address, 3);
+    w.String(": ");
+    w.out += FormatInstruction(w.out, line.instruction);
+
+    line.text = std::string_view(buffer, w.out - buffer);
+    return line.size;
+}
+
+/**
+ * Get the size of a buffer that can always hold the disassembly of length bytes
+ */
+size_t GetDisassemblySizeBound(size_t length)
+{
+    /* Worst case every byte is a .BYTE line */
+    return length * MaxDisassemblyLineLength;
+}
+
+/**
+ * Disassemble a block of code into a caller-provided buffer in one pass
+ * @param buffer   Output buffer, not null-terminated
+ * @param capacity Size of the buffer, GetDisassemblySizeBound(length) is always enough
+ * @param code     Code to disassemble
+ * @param length   Length of the code in bytes
+ * @param origin   Address of the first byte
+ * @return Number of characters written, output stops at the last line that fits
+ */
+size_t DisassembleTo(char* buffer, size_t capacity, const uint8_t* code, size_t length, int origin)
+{
+    char lineBuffer[MaxDisassemblyLineLength];
+    DisassembledLine line;
+    size_t offset = 0;
+    size_t written = 0;
+
+    while (offset < length)
+    {
+        /* Format straight into the output whenever a full line is sure to fit */
+        char* out = (capacity - written >= MaxDisassemblyLineLength) ? buffer + written : lineBuffer;
+
+        offset += DisassembleLine(line, out, code, length, offset, origin);
+        if (written + line.text.size() + 1 > capacity)
+            break;
+
+        if (out == lineBuffer)
+            std::copy(line.text.begin(), line.text.end(), buffer + written);
+
+        written += line.text.size();
+        buffer[written++] = '\n';
+    }
+
+    return written;
+}
+
 std::string Disassemble(const uint8_t* code, size_t length, int origin)
 {
     std::string disassembly;
 
-    if (reinterpret_cast<uintptr_t>(code) & 0x1)
+    disassembly.resize(GetDisassemblySizeBound(length));
+    disassembly.resize(DisassembleTo(disassembly.data(), disassembly.size(), code, length, origin));
+    return disassembly;
+}
+
+/* Labels are only emitted at instruction starts and data bytes */
+static bool HasLabel(const CodeMap& map, int address)
+{
+    uint8_t flags = map.GetFlags(address);
+    return (flags & (CodeMap::Label | CodeMap::DataRef)) && !(flags & CodeMap::Operand);
+}
+
+static void WriteLabel(LineWriter& w, const CodeMap& map, int address)
+{
+    w.Char(map.IsCode(address) ? 'L' : 'D');
+    w.Char('_');
+    w.Hex(address, 3);
+}
+
+/**
+ * Disassemble a program using the code/data separation of a CodeMap. Reached
+ * instructions are decoded, everything else is emitted as .BYTE, and the
+ * targets of jumps, calls and LD I get labels.
+ * @param code   Code to disassemble, the same the map was built from
+ * @param length Length of the code in bytes
+ * @param map    Code map of the program
+ * @return The disassembly
+ */
+std::string Disassemble(const uint8_t* code, size_t length, const CodeMap& map)
+{
+    std::string disassembly;
+    char lineBuffer[MaxDisassemblyLineLength * 2];
+    size_t offset = 0;
+
+    disassembly.reserve(GetDisassemblySizeBound(length));
+    while (offset < length)
     {
-        if (length > 1)
+        int address = map.GetOrigin() + static_cast<int>(offset);
+        LineWriter w{ lineBuffer };
+
+        if (HasLabel(map, address))
         {
-            ++code;
-            --length;
+            WriteLabel(w, map, address);
+            w.String(":\n");
         }
-        else
-            return disassembly;
-    }
 
-    for (int i = 0; i < length; i += 2)
-    {
-        int ip = origin + i;
-        char lineBuffer[80] = { };
-        char insBuffer[32] = { };
-        Instruction ins(((int)code[i] << 8) | code[i + 1]);
-        const char* name = Instruction::GetName(ins.type).c_str();
+        w.String("0x");
+        w.Hex(address, 3);
+        w.String(": ");
 
-        switch (ins.type)
+        if (map.GetFlags(address) & CodeMap::Code)
         {
-        case Instruction::Type::CLS:
-        case Instruction::Type::RET:
-            sprintf_s(insBuffer, name);
-            break;
-        case Instruction::Type::JP:
-        case Instruction::Type::CALL:
-            sprintf_s(insBuffer, "%s #0x%03X", name, ins.address);
-            break;
-        case Instruction::Type::JP_V0_IMM:
-            sprintf_s(insBuffer, "JP V0, #0x%03X", ins.address);
-            break;
-        case Instruction::Type::SE:
-            if (ins.encoding == Instruction::Encoding::DestinationByte)
-                sprintf_s(insBuffer, "SE V%c, #0x%02X", s_HexDigits[ins.dst], ins.byte);
-            else if (ins.encoding == Instruction::Encoding::DestinationSource)
-                sprintf_s(insBuffer, "SE V%c, V%c", s_HexDigits[ins.dst], s_HexDigits[ins.src]);
-            break;
-        case Instruction::Type::SNE:
-            if (ins.encoding == Instruction::Encoding::DestinationByte)
-                sprintf_s(insBuffer, "SNE V%c, #0x%02X", s_HexDigits[ins.dst], ins.byte);
-            else if (ins.encoding == Instruction::Encoding::DestinationSource)
-                sprintf_s(insBuffer, "SNE V%c, V%c", s_HexDigits[ins.dst], s_HexDigits[ins.src]);
-            break;
-        case Instruction::Type::LD:
-            if (ins.encoding == Instruction::Encoding::DestinationByte)
-                sprintf_s(insBuffer, "LD V%c, #0x%02X", s_HexDigits[ins.dst], ins.byte);
-            else if (ins.encoding == Instruction::Encoding::DestinationSource)
-                sprintf_s(insBuffer, "LD V%c, V%c", s_HexDigits[ins.dst], s_HexDigits[ins.src]);
-            break;
-        case Instruction::Type::ADD:
-            if (ins.encoding == Instruction::Encoding::DestinationByte)
-                sprintf_s(insBuffer, "ADD V%c, #0x%02X", s_HexDigits[ins.dst], ins.byte);
-            else if (ins.encoding == Instruction::Encoding::DestinationSource)
-                sprintf_s(insBuffer, "ADD V%c, V%c", s_HexDigits[ins.dst], s_HexDigits[ins.src]);
-            break;
-        case Instruction::Type::OR:
-        case Instruction::Type::AND:
-        case Instruction::Type::XOR:
-        case Instruction::Type::SUB:
-        case Instruction::Type::SUBN:
-            sprintf_s(insBuffer, "%s V%c, V%c", name, s_HexDigits[ins.dst], s_HexDigits[ins.src]);
-            break;
-        case Instruction::Type::SHR:
-        case Instruction::Type::SHL:
-        case Instruction::Type::SKP:
-        case Instruction::Type::SKNP:
-            sprintf_s(insBuffer, "%s V%c", name, s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::RND:
-            sprintf_s(insBuffer, "RND V%c, #0x%02X", s_HexDigits[ins.dst], ins.byte);
-            break;
-        case Instruction::Type::DRW:
-            sprintf_s(insBuffer, "DRW V%c, V%c, %d",
-                s_HexDigits[ins.dst],
-                s_HexDigits[ins.src],
-                ins.byte & 0xF);
-            break;
-        case Instruction::Type::LD_F_V:
-            sprintf_s(insBuffer, "LD F, V%c", s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::LD_B_V:
-            sprintf_s(insBuffer, "LD B, V%c", s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::LD_I_IMM:
-            sprintf_s(insBuffer, "LD I, #0x%03X", ins.address);
-            break;
-        case Instruction::Type::LD_I_V0V:
-            sprintf_s(insBuffer, "LD [I], V%c", s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::LD_V0V_I:
-            sprintf_s(insBuffer, "LD V%c, [I]", s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::LD_V_DT:
-            sprintf_s(insBuffer, "LD V%c, DT", s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::LD_V_K:
-            sprintf_s(insBuffer, "LD V%c, K", s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::LD_DT_V:
-            sprintf_s(insBuffer, "LD DT, V%c", s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::LD_ST_V:
-            sprintf_s(insBuffer, "LD ST, V%c", s_HexDigits[ins.dst]);
-            break;
-        case Instruction::Type::ADD_I_V:
-            sprintf_s(insBuffer, "ADD I, V%c", s_HexDigits[ins.dst]);
-            break;
-        default:
-            sprintf_s(insBuffer, ".BYTE #0x%02X", code[i]);
-            --i;
-            break;
+            Instruction ins((code[offset] << 8) | code[offset + 1]);
+
+            if (ins.encoding == Instruction::Encoding::Address && HasLabel(map, ins.GetAddress()))
+            {
+                if (ins.type == Instruction::Type::JP_V0_IMM)
+                    w.String("JP V0, ");
+                else if (ins.type == Instruction::Type::LD_I_IMM)
+                    w.String("LD I, ");
+                else
+                {
+                    w.String(Instruction::GetName(ins.type));
+                    w.Char(' ');
+                }
+                WriteLabel(w, map, ins.GetAddress());
+            }
+            else
+            {
+                w.out += FormatInstruction(w.out, ins);
+            }
+            offset += 2;
+        }
+        else
+        {
+            w.String(".BYTE ");
+            w.Immediate(code[offset], 2);
+            ++offset;
         }
 
-        sprintf_s(lineBuffer, "0x%03X: %s\n", ip, insBuffer);
-        disassembly += lineBuffer;
+        w.Char('\n');
+        disassembly.append(lineBuffer, w.out - lineBuffer);
     }
 
     return disassembly;
-}
\ No newline at end of file
+}
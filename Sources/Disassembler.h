@@ -1,6 +1,46 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include "Instruction.h"
+#include "CodeMap.h"
 
-std::string Disassemble(const uint8_t* code, size_t length, int origin);
\ No newline at end of file
+/* Longest line the disassembler can produce, including the trailing newline */
+constexpr size_t MaxDisassemblyLineLength = 32;
+
+struct DisassembledLine
+{
+    uint16_t         address;
+    uint16_t         word;         // Raw instruction word, or the lone byte of a .BYTE line
+    uint8_t          size;         // Bytes consumed, 1 for .BYTE lines
+    Instruction      instruction;
+    std::string_view text;         // Formatted line without the trailing newline
+};
+
+size_t FormatInstruction(char* out, const Instruction& ins);
+size_t DisassembleLine(DisassembledLine& line, char* buffer, const uint8_t* code, size_t length, size_t offset, int origin);
+size_t GetDisassemblySizeBound(size_t length);
+size_t DisassembleTo(char* buffer, size_t capacity, const uint8_t* code, size_t length, int origin);
+std::string Disassemble(const uint8_t* code, size_t length, int origin);
+std::string Disassemble(const uint8_t* code, size_t length, const CodeMap& map);
+
+/**
+ * Disassemble a block of code one line at a time without allocating
+ * @param code   Code to disassemble
+ * @param length Length of the code in bytes
+ * @param origin Address of the first byte
+ * @param sink   Called with every DisassembledLine, whose text is only valid during the call
+ */
+template <class Sink>
+void DisassembleStream(const uint8_t* code, size_t length, int origin, Sink&& sink)
+{
+    char buffer[MaxDisassemblyLineLength];
+    DisassembledLine line;
+    size_t offset = 0;
+
+    while (offset < length)
+    {
+        offset += DisassembleLine(line, buffer, code, length, offset, origin);
+        sink(line);
+    }
+}
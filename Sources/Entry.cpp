@@ -1,12 +1,98 @@
+#include <chrono>
+#include <ctime>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <filesystem>
 #include <SDL.h>
 #include <SDL_ttf.h>
 #include "Instruction.h"
 #include "Disassembler.h"
 #include "Assembler.h"
+#include "Audio.h"
 #include "Core.h"
+#include "Corpus.h"
+#include "Debugger.h"
 #include "Font.h"
+#include "FrameBuffer.h"
+#include "IncrementalAssembler.h"
+#include "MemoryView.h"
+#include "Movie.h"
+#include "NativeProgram.h"
+#include "Recompiler.h"
+#include "Rewind.h"
+#include "Snapshot.h"
+#include "Tokenizer.h"
+#include "Trace.h"
+
+static bool ReadTextFile(const std::filesystem::path& path, std::string& text)
+{
+    std::ifstream input(path, std::ios::binary | std::ios::in);
+    std::stringstream buffer;
+
+    if (!input.is_open())
+        return false;
+
+    buffer << input.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+/**
+ * Add a breakpoint or watchpoint given on the command line
+ * @param debugger Debugger to add it to
+ * @param option   --break, --watch-read, --watch-write or --break-change
+ * @param value    Address, or register name V0-VF or I for --break-change. A
+ *                 breakpoint address can be followed by "if" and a condition.
+ * @return True on success, false if the option or value is not valid
+ */
+static bool AddDebugPoint(Debugger& debugger, std::string_view option, std::string_view value)
+{
+    Keyword keyword;
+    Condition condition;
+    int address;
+
+    if (option == "--break-change")
+    {
+        if (LookupKeyword(value, keyword) && keyword >= Keyword::V0 && keyword <= Keyword::VF)
+            debugger.SetRegisterWatch(static_cast<uint8_t>(static_cast<int>(keyword) - static_cast<int>(Keyword::V0)));
+        else if (LookupKeyword(value, keyword) && keyword == Keyword::I)
+            debugger.SetRegisterWatch(Debugger::RegisterI);
+        else
+        {
+            printf("ERROR: '%.*s' is not a register\n", static_cast<int>(value.size()), value.data());
+            return false;
+        }
+        return true;
+    }
+
+    size_t split = value.find(" if ");
+    if (option == "--break" && split != std::string_view::npos)
+    {
+        if (!condition.Compile(value.substr(split + 4)))
+            return false;
+        value = value.substr(0, split);
+    }
+
+    if (!ParseInteger(value, address) || address < 0 || address >= Core::MemorySize)
+    {
+        printf("ERROR: '%.*s' is not an address\n", static_cast<int>(value.size()), value.data());
+        return false;
+    }
+
+    if (option == "--break")
+        debugger.SetBreakpoint(static_cast<uint16_t>(address), condition);
+    else if (option == "--watch-read")
+        debugger.SetReadWatch(static_cast<uint16_t>(address));
+    else if (option == "--watch-write")
+        debugger.SetWriteWatch(static_cast<uint16_t>(address));
+    else
+    {
+        printf("ERROR: unknown option '%.*s'\n", static_cast<int>(option.size()), option.data());
+        return false;
+    }
+    return true;
+}
 
 class Application
 {
@@ -14,7 +100,11 @@ public:
     Application(const std::vector<uint8_t>& program)
         : m_Window(nullptr), m_Renderer(nullptr),
         m_DisplayTexture(nullptr),
-        m_DisplayRect{ }, m_RegistersRect{ }, m_MemoryRect{ }
+        m_DisplayRect{ }, m_RegistersRect{ }, m_MemoryRect{ },
+        m_LivePollFrames(0),
+        m_InputTicks(0), m_InputCycle(0), m_CyclesPerTick(0), m_InputLead(0),
+        m_QuickSave{ }, m_HasQuickSave(false), m_Rewinding(false),
+        m_RunAheadState{ }, m_RunAheadFrames(0), m_Paused(false)
     {
         m_Window = SDL_CreateWindow("CHIP-8 Emulator",
             SDL_WINDOWPOS_CENTERED,
@@ -31,6 +121,7 @@ public:
             Core::DisplayHeight);
 
         m_DebugFont = std::make_unique<Font>(m_Renderer, "C:\\Windows\\fonts\\vgafix.fon", 12);
+        m_MemoryView = std::make_unique<MemoryView>(m_Renderer, *m_DebugFont.get());
 
         UpdateRectangles(800, 600);
 
@@ -39,11 +130,102 @@ public:
 
     ~Application()
     {
+        m_MemoryView.reset();
         SDL_DestroyTexture(m_DisplayTexture);
         SDL_DestroyRenderer(m_Renderer);
         SDL_DestroyWindow(m_Window);
     }
 
+    /**
+     * Reassemble a source file whenever it changes and patch the result into the running program
+     * @param path      Source file the program was assembled from
+     * @param assembler Assembler that built the program
+     */
+    void WatchSource(const std::filesystem::path& path, std::unique_ptr<IncrementalAssembler> assembler)
+    {
+        std::error_code error;
+
+        m_LivePath = path;
+        m_LiveTime = std::filesystem::last_write_time(path, error);
+        m_LiveAssembler = std::move(assembler);
+    }
+
+    void PollSource()
+    {
+        static constexpr int PollInterval = 15;
+        std::error_code error;
+        std::string code;
+
+        if (!m_LiveAssembler || ++m_LivePollFrames < PollInterval)
+            return;
+        m_LivePollFrames = 0;
+
+        auto time = std::filesystem::last_write_time(m_LivePath, error);
+        if (error || time == m_LiveTime || !ReadTextFile(m_LivePath, code))
+            return;
+        m_LiveTime = time;
+
+        if (m_LiveAssembler->Update(code))
+            m_LiveAssembler->ApplyPatches(m_Core);
+    }
+
+    /**
+     * Run the program through a recompiled library instead of the interpreter
+     * @param native Library built from the loaded program
+     */
+    void UseNativeProgram(std::unique_ptr<NativeProgram> native)
+    {
+        m_NativeProgram = std::move(native);
+    }
+
+    void SetRandomSeed(uint32_t seed)
+    {
+        m_Core.SetRandomSeed(seed);
+    }
+
+    /**
+     * Record the session into a movie, written when the window is closed
+     * @param path     File to write the movie to
+     * @param recorder Recorder started with the loaded program and the core's seed
+     */
+    void Record(const std::filesystem::path& path, std::unique_ptr<MovieRecorder> recorder)
+    {
+        m_MoviePath = path;
+        m_Recorder = std::move(recorder);
+    }
+
+    /**
+     * Play a movie instead of reading the keyboard. Keys and timer ticks come
+     * from the movie, so the session runs exactly as it was recorded.
+     * @param player Player for a movie of the loaded program, whose seed the core was given
+     */
+    void Play(std::unique_ptr<MoviePlayer> player)
+    {
+        m_Player = std::move(player);
+    }
+
+    /**
+     * Run the core through a debugger, which takes the place of the
+     * recompiled program while it is attached. F8 breaks and continues,
+     * F10 steps one instruction while the core is stopped.
+     * @param debugger Debugger with the breakpoints and watchpoints to stop at
+     */
+    void Debug(std::unique_ptr<Debugger> debugger)
+    {
+        m_Debugger = std::move(debugger);
+    }
+
+    /**
+     * Record every instruction the program runs. Like the debugger, the
+     * tracer takes the place of the recompiled program, and an attached
+     * debugger takes precedence over it.
+     * @param tracer Tracer that was opened on the output file
+     */
+    void Trace(std::unique_ptr<Tracer> tracer)
+    {
+        m_Tracer = std::move(tracer);
+    }
+
     void Run()
     {
         SDL_Event event;
@@ -58,6 +240,13 @@ public:
         double delaySpeed = 60;
         double delayCount = 0;
 
+        m_CyclesPerTick = targetSpeed / 1000;
+        m_InputTicks = SDL_GetTicks();
+        m_InputCycle = m_Core.GetCycles();
+
+        if (m_Audio.Open(targetSpeed))
+            m_Core.SetAudioListener(&m_Audio);
+
         while (!quitting)
         {
             while (SDL_PollEvent(&event))
@@ -68,58 +257,102 @@ public:
                     quitting = true;
                     break;
                 case SDL_KEYDOWN:
-                    if (event.key.keysym.sym == SDLK_UP)
-                        m_Core.KeyDown(2);
-                    else if (event.key.keysym.sym == SDLK_DOWN)
-                        m_Core.KeyDown(8);
-                    else if (event.key.keysym.sym == SDLK_LEFT)
-                        m_Core.KeyDown(4);
-                    else if (event.key.keysym.sym == SDLK_RIGHT)
-                        m_Core.KeyDown(6);
-                    else if (event.key.keysym.sym == SDLK_SPACE)
-                        m_Core.KeyDown(5);
-                    break;
                 case SDL_KEYUP:
-                    if (event.key.keysym.sym == SDLK_UP)
-                        m_Core.KeyUp(2);
-                    else if (event.key.keysym.sym == SDLK_DOWN)
-                        m_Core.KeyUp(8);
-                    else if (event.key.keysym.sym == SDLK_LEFT)
-                        m_Core.KeyUp(4);
-                    else if (event.key.keysym.sym == SDLK_RIGHT)
-                        m_Core.KeyUp(6);
-                    else if (event.key.keysym.sym == SDLK_SPACE)
-                        m_Core.KeyUp(5);
+                {
+                    int key = MapKey(event.key.keysym.sym);
+                    bool down = event.type == SDL_KEYDOWN;
+
+                    if (down && event.key.keysym.sym == SDLK_F5)
+                        SaveQuickState();
+                    else if (down && event.key.keysym.sym == SDLK_F9)
+                        LoadQuickState();
+                    else if (event.key.keysym.sym == SDLK_BACKSPACE)
+                        m_Rewinding = down && !m_Recorder && !m_Player;
+                    else if (down && event.key.keysym.sym == SDLK_F8 && m_Debugger)
+                        m_Paused = !m_Paused;
+                    else if (down && event.key.keysym.sym == SDLK_F10 && m_Debugger && m_Paused)
+                        StepDebugger();
+
+                    if (key == -1 || m_Player)
+                        break;
+
+                    uint64_t cycle = m_Core.QueueKey(GetInputCycle(event.key.timestamp), key, down);
+                    if (cycle == UINT64_MAX)
+                        printf("WARNING: key event dropped, %d events are already waiting\n", InputQueue::Capacity);
+                    else if (m_Recorder)
+                        m_Recorder->RecordKey(cycle, key, down);
                     break;
                 }
+                }
             }
 
+            PollSource();
+
             const double target = (1 / targetSpeed);
             const double delay = (1 / delaySpeed);
 
+            /* Holding backspace steps back one captured frame per host frame, a stopped debugger holds the core */
+            bool running = !m_Rewinding && !m_Paused;
+            if (!running)
+            {
+                if (m_Rewinding)
+                    m_Rewind.StepBack(m_Core);
+                m_InputTicks = SDL_GetTicks();
+                m_InputCycle = m_Core.GetCycles();
+                targetCount = 0;
+                delayCount = 0;
+            }
+
             targetCount += deltaTime;
             delayCount += deltaTime;
-            if (targetCount >= target)
+            if (running && targetCount >= target)
             {
                 int cycles = static_cast<int>(std::round(targetCount / target));
-                for (int i = 0; !m_Core.WaitingForKey() && (i < cycles); i++)
-                    m_Core.DoCycle();
+                if (m_Player)
+                    m_Player->Run(m_Core, cycles);
+                else if (m_Debugger)
+                {
+                    m_Debugger->Run(m_Core, cycles);
+                    if (m_Debugger->IsStopped())
+                    {
+                        m_Paused = true;
+                        ReportStop();
+                    }
+                }
+                else if (m_Tracer)
+                    m_Tracer->Run(m_Core, cycles);
+                else if (m_NativeProgram)
+                    m_NativeProgram->Run(m_Core, cycles);
+                else
+                    m_Core.RunCycles(cycles);
                 targetCount = 0;
+
+                m_InputTicks = SDL_GetTicks();
+                m_InputCycle = m_Core.GetCycles();
             }
 
-            if (delayCount >= delay)
+            if (running && delayCount >= delay)
             {
                 int counts = static_cast<int>(std::round(delayCount / delay));
-                for (int i = 0; i < counts; i++)
-                    m_Core.DecrementDT();
+                for (int i = 0; i < counts && !m_Player; i++)
+                {
+                    m_Core.TickTimers();
+                    if (m_Recorder)
+                        m_Recorder->RecordTimerTick(m_Core);
+                }
                 delayCount = 0;
             }
 
-            if (m_Core.UpdateDisplay())
+            if (running)
+                m_Rewind.Capture(m_Core);
+
+            if (m_RunAheadFrames > 0 && running && !m_Player && !m_Debugger)
+                RunAhead(static_cast<int>(std::round(targetSpeed / delaySpeed)));
+            else if (m_FrameBuffer.Update(m_Core))
             {
                 SDL_UpdateTexture(m_DisplayTexture,
                     nullptr,
-                    m_Core.GetDisplayBuffer().data(),
+                    m_FrameBuffer.GetPixels().data(),
                     Core::DisplayWidth * 4);
             }
 
@@ -129,6 +362,156 @@ public:
             deltaTime = (double)(count - start) / (double)frequency;
             start = count;
         }
+
+        if (m_Recorder)
+            m_Recorder->Save(m_MoviePath, m_Core);
+        if (m_Tracer)
+            m_Tracer->Close();
+    }
+
+    void StepDebugger()
+    {
+        m_Debugger->Step(m_Core);
+        if (m_Debugger->IsStopped())
+            ReportStop();
+
+        char text[MaxDisassemblyLineLength];
+        text[FormatInstruction(text, Instruction(m_Core.ReadWord(m_Core.GetIP())))] = '\0';
+        printf("0x%03X: %s\n", m_Core.GetIP(), text);
+    }
+
+    void ReportStop()
+    {
+        const DebugStop& stop = m_Debugger->GetStop();
+
+        switch (stop.reason)
+        {
+        case DebugStop::Reason::Breakpoint:
+            printf("Breakpoint at 0x%03X\n", stop.ip);
+            break;
+        case DebugStop::Reason::Read:
+            printf("Read of 0x%03X by the instruction at 0x%03X\n", stop.address, stop.ip);
+            break;
+        case DebugStop::Reason::Write:
+            printf("Write to 0x%03X by the instruction at 0x%03X\n", stop.address, stop.ip);
+            break;
+        case DebugStop::Reason::Register:
+            if (stop.reg == Debugger::RegisterI)
+                printf("I changed by the instruction at 0x%03X\n", stop.ip);
+            else
+                printf("V%X changed by the instruction at 0x%03X\n", stop.reg, stop.ip);
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* F5 keeps the state of the core in memory and on disk */
+    void SaveQuickState()
+    {
+        m_Core.SaveState(m_QuickSave);
+        m_HasQuickSave = true;
+        SaveSnapshot(QuickSavePath, m_QuickSave);
+    }
+
+    /* F9 goes back to it, reading the file if nothing was saved in this session */
+    void LoadQuickState()
+    {
+        if (m_Recorder || m_Player)
+        {
+            puts("ERROR: states can not be loaded while a movie is recording or playing");
+            return;
+        }
+
+        if (!m_HasQuickSave && !LoadSnapshot(QuickSavePath, m_QuickSave))
+            return;
+        m_HasQuickSave = true;
+
+        m_Core.LoadState(m_QuickSave);
+        m_InputTicks = SDL_GetTicks();
+        m_InputCycle = m_Core.GetCycles();
+    }
+
+    /**
+     * Show the frame the core reaches a number of frames from now instead of
+     * the current one, which hides that much of the program's own input lag
+     * @param frames Number of frames, 0 to turn run-ahead off
+     */
+    void SetRunAhead(int frames)
+    {
+        m_RunAheadFrames = frames;
+    }
+
+    /**
+     * Run the core ahead with the keys as they are now, show the frame it
+     * reaches and go back to where it was
+     * @param cyclesPerFrame Cycles the core runs between timer ticks
+     */
+    void RunAhead(int cyclesPerFrame)
+    {
+        m_Core.SaveState(m_RunAheadState);
+        m_RunAheadInput = m_Core.GetInputQueue();
+        m_Core.SetAudioListener(nullptr);
+
+        for (int frame = 0; frame < m_RunAheadFrames; frame++)
+        {
+            if (m_NativeProgram)
+                m_NativeProgram->Run(m_Core, cyclesPerFrame);
+            else
+                m_Core.RunCycles(cyclesPerFrame);
+            m_Core.TickTimers();
+        }
+
+        /* Only the frame that is shown is converted and uploaded */
+        if (m_FrameBuffer.Update(m_Core))
+        {
+            SDL_UpdateTexture(m_DisplayTexture,
+                nullptr,
+                m_FrameBuffer.GetPixels().data(),
+                Core::DisplayWidth * 4);
+        }
+
+        m_Core.LoadState(m_RunAheadState);
+        m_Core.SetInputQueue(m_RunAheadInput);
+        m_Core.SetAudioListener(m_Audio.IsOpen() ? &m_Audio : nullptr);
+    }
+
+    /**
+     * Delay every key event by a number of cycles, which evens out the host
+     * delivering events a frame at a time at the cost of latency
+     * @param cycles Number of cycles
+     */
+    void SetInputLead(int cycles)
+    {
+        m_InputLead = cycles;
+    }
+
+    static int MapKey(SDL_Keycode sym)
+    {
+        switch (sym)
+        {
+        case SDLK_UP:    return 2;
+        case SDLK_DOWN:  return 8;
+        case SDLK_LEFT:  return 4;
+        case SDLK_RIGHT: return 6;
+        case SDLK_SPACE: return 5;
+        default:         return -1;
+        }
+    }
+
+    /**
+     * Map the time an event arrived to the cycle it takes effect on. Events
+     * that arrived since the core last ran land at the same point of the next
+     * batch of cycles as they did in the time it covers.
+     * @param timestamp SDL timestamp of the event in milliseconds
+     * @return Cycle to apply the event at
+     */
+    uint64_t GetInputCycle(uint32_t timestamp) const
+    {
+        int32_t elapsed = static_cast<int32_t>(timestamp - m_InputTicks);
+        double offset = std::max(0.0, elapsed * m_CyclesPerTick) + m_InputLead;
+
+        return m_InputCycle + static_cast<uint64_t>(offset);
     }
 
     void UpdateRectangles(int displayWidth, int displayHeight)
@@ -214,10 +597,20 @@ public:
         registerY += m_DebugFont->GetHeight();
         DrawString(*m_DebugFont.get(), registerX, registerY, "SP: 0x%04X", m_Core.GetSP());
 
+        if (m_Paused)
+        {
+            registerY += m_DebugFont->GetHeight() * 2;
+            DrawString(*m_DebugFont.get(), registerX, registerY, "STOPPED (F8 continue, F10 step)");
+        }
+
+        m_MemoryView->Draw(m_Core, m_MemoryRect);
+
         SDL_RenderPresent(m_Renderer);
     }
 
 private:
+    static constexpr char QuickSavePath[] = "quicksave.c8s";
+
     SDL_Window* m_Window;
     SDL_Renderer* m_Renderer;
     SDL_Texture* m_DisplayTexture;
@@ -226,48 +619,274 @@ private:
     SDL_Rect      m_MemoryRect;
 
     Core m_Core;
+    FrameBuffer m_FrameBuffer;
+    AudioOutput m_Audio;
     std::unique_ptr<Font> m_DebugFont;
+    std::unique_ptr<MemoryView> m_MemoryView;
+
+    std::unique_ptr<IncrementalAssembler> m_LiveAssembler;
+    std::filesystem::path m_LivePath;
+    std::filesystem::file_time_type m_LiveTime;
+    int m_LivePollFrames;
+
+    std::unique_ptr<NativeProgram> m_NativeProgram;
+
+    std::unique_ptr<MovieRecorder> m_Recorder;
+    std::unique_ptr<MoviePlayer> m_Player;
+    std::filesystem::path m_MoviePath;
+
+    CoreSnapshot m_QuickSave;
+    bool m_HasQuickSave;
+
+    RewindBuffer m_Rewind;
+    bool m_Rewinding;
+
+    CoreSnapshot m_RunAheadState;
+    InputQueue m_RunAheadInput;
+    int m_RunAheadFrames;
+
+    std::unique_ptr<Debugger> m_Debugger;
+    bool m_Paused;
+
+    std::unique_ptr<Tracer> m_Tracer;
+
+    uint32_t m_InputTicks;      // Time the core last ran
+    uint64_t m_InputCycle;      // Cycle the core had reached then
+    double   m_CyclesPerTick;
+    int      m_InputLead;
 };
 
 int main(int argc, char** argv)
 {
     std::vector<uint8_t> program;
 
-#if 0
-    const std::string code = R"(
-       LD  V1, #4
-    A: LD  V0, K
-       CLS
-       LD  F,  V0
-       DRW V1, V1, #5
-       JP  A
-    )";
-
-    if (!Assemble(program, code))
-    {
-        std::cout << "Assembly failed!" << std::endl;
-        return 1;
+    if (argc >= 2 && std::string(argv[1]) == "--corpus")
+    {
+        if (argc < 4)
+        {
+            puts("Usage: Chip8-Emulator --corpus <rom directory> <output directory>");
+            return 1;
+        }
+        return DisassembleCorpus(argv[2], argv[3]) ? 0 : 1;
     }
 
-    std::cout << "Assembly source: \n" << code << std::endl;
-#else
-    std::ifstream input("Roms/Delay Timer Test [Matthew Mikolay, 2010].ch8", std::ios::binary | std::ios::in);
-    if (!input.is_open())
-        return 1;
+    if (argc >= 2 && std::string(argv[1]) == "--assemble")
+    {
+        std::string code;
+        bool optimize = argc >= 5 && std::string(argv[4]) == "--optimize";
+
+        if (argc < 4)
+        {
+            puts("Usage: Chip8-Emulator --assemble <source file> <output file> [--optimize]");
+            return 1;
+        }
+
+        if (!ReadTextFile(argv[2], code))
+        {
+            printf("ERROR: failed to read '%s'\n", argv[2]);
+            return 1;
+        }
+
+        if (!Assemble(program, code, 0x200, optimize))
+        {
+            std::cout << "Assembly failed!" << std::endl;
+            return 1;
+        }
+
+        std::ofstream output(argv[3], std::ios::binary | std::ios::out);
+        output.write(reinterpret_cast<const char*>(program.data()), program.size());
+        return output ? 0 : 1;
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--recompile")
+    {
+        std::string rom;
+
+        if (argc < 4)
+        {
+            puts("Usage: Chip8-Emulator --recompile <rom file> <output library>");
+            return 1;
+        }
+
+        if (!ReadTextFile(argv[2], rom))
+        {
+            printf("ERROR: failed to read '%s'\n", argv[2]);
+            return 1;
+        }
+
+        program.assign(rom.begin(), rom.end());
+        return RecompileProgram(program, 0x200, argv[3]) ? 0 : 1;
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--decode-trace")
+    {
+        if (argc < 4)
+        {
+            puts("Usage: Chip8-Emulator --decode-trace <trace file> <output file>");
+            return 1;
+        }
+        return DecodeTrace(argv[2], argv[3]) ? 0 : 1;
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--replay")
+    {
+        std::string rom;
+        Movie movie;
+
+        if (argc < 4)
+        {
+            puts("Usage: Chip8-Emulator --replay <rom file> <movie file>");
+            return 1;
+        }
 
-    input.seekg(0, std::ios::end);
-    size_t size = input.tellg();
-    program.resize(size);
-    input.seekg(0, std::ios::beg);
-    input.read(reinterpret_cast<char*>(program.data()), size);
+        if (!ReadTextFile(argv[2], rom))
+        {
+            printf("ERROR: failed to read '%s'\n", argv[2]);
+            return 1;
+        }
+
+        if (!LoadMovie(argv[3], movie))
+            return 1;
+
+        program.assign(rom.begin(), rom.end());
+        MoviePlayer player(std::move(movie));
+        if (!player.Matches(program))
+        {
+            puts("ERROR: the movie was recorded with a different program");
+            return 1;
+        }
+
+        /* Same setup as Application, without a window or a clock */
+        Core core;
+        core.LoadData(program, 0x200);
+        core.SetRandomSeed(player.GetSeed());
+
+        auto start = std::chrono::steady_clock::now();
+        while (!player.IsFinished(core))
+            player.Run(core, 1 << 20);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("Replayed %llu cycles in %.3f seconds (%.1f million cycles per second), %d out of sync\n",
+            static_cast<unsigned long long>(core.GetCycles()), elapsed.count(),
+            core.GetCycles() / std::max(elapsed.count(), 1e-9) / 1e6, player.GetDesyncCount());
+        return player.GetDesyncCount() == 0 ? 0 : 1;
+    }
+
+    std::unique_ptr<IncrementalAssembler> liveAssembler;
+    std::unique_ptr<NativeProgram> nativeProgram;
+    std::filesystem::path livePath;
+    int inputLead = 0;
+    int runAhead = 0;
+    const char* recordPath = nullptr;
+    const char* playPath = nullptr;
+    const char* tracePath = nullptr;
+    std::unique_ptr<Debugger> debugger;
+
+    /* Can follow any of the modes below */
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (std::string(argv[i]) == "--input-lead")
+            inputLead = std::max(0, atoi(argv[i + 1]));
+        else if (std::string(argv[i]) == "--run-ahead")
+            runAhead = std::clamp(atoi(argv[i + 1]), 0, 8);
+        else if (std::string(argv[i]) == "--record")
+            recordPath = argv[i + 1];
+        else if (std::string(argv[i]) == "--play")
+            playPath = argv[i + 1];
+        else if (std::string(argv[i]) == "--trace")
+            tracePath = argv[i + 1];
+        else if (std::string(argv[i]).starts_with("--break") || std::string(argv[i]).starts_with("--watch"))
+        {
+            if (!debugger)
+                debugger = std::make_unique<Debugger>();
+            if (!AddDebugPoint(*debugger, argv[i], argv[i + 1]))
+                return 1;
+        }
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--native")
+    {
+        if (argc < 3)
+        {
+            puts("Usage: Chip8-Emulator --native <recompiled library>");
+            return 1;
+        }
+
+        nativeProgram = std::make_unique<NativeProgram>();
+        if (!nativeProgram->Open(argv[2]))
+            return 1;
+
+        if (nativeProgram->GetOrigin() != 0x200)
+        {
+            puts("ERROR: the library was not built for programs loaded at 0x200");
+            return 1;
+        }
+        program = nativeProgram->GetImage();
+    }
+    else if (argc >= 2 && std::string(argv[1]) == "--live")
+    {
+        std::string code;
+
+        if (argc < 3)
+        {
+            puts("Usage: Chip8-Emulator --live <source file>");
+            return 1;
+        }
+
+        livePath = argv[2];
+        if (!ReadTextFile(livePath, code))
+        {
+            printf("ERROR: failed to read '%s'\n", livePath.string().c_str());
+            return 1;
+        }
+
+        liveAssembler = std::make_unique<IncrementalAssembler>();
+        if (!liveAssembler->Update(code))
+        {
+            std::cout << "Assembly failed!" << std::endl;
+            return 1;
+        }
+        program = liveAssembler->GetProgram();
+    }
+    else
+    {
+#if 0
+        const std::string code = R"(
+           LD  V1, #4
+        A: LD  V0, K
+           CLS
+           LD  F,  V0
+           DRW V1, V1, #5
+           JP  A
+        )";
+
+        if (!Assemble(program, code))
+        {
+            std::cout << "Assembly failed!" << std::endl;
+            return 1;
+        }
+
+        std::cout << "Assembly source: \n" << code << std::endl;
+#else
+        std::ifstream input("Roms/Delay Timer Test [Matthew Mikolay, 2010].ch8", std::ios::binary | std::ios::in);
+        if (!input.is_open())
+            return 1;
+
+        input.seekg(0, std::ios::end);
+        size_t size = input.tellg();
+        program.resize(size);
+        input.seekg(0, std::ios::beg);
+        input.read(reinterpret_cast<char*>(program.data()), size);
 #endif
+    }
 
-    std::cout << Disassemble(program.data(), program.size(), 0x200) << std::endl;
+    CodeMap codeMap(program.data(), program.size(), 0x200);
+    std::cout << Disassemble(program.data(), program.size(), codeMap) << std::endl;
 
     std::ofstream output("out.bin");
     output.write(reinterpret_cast<const char*>(program.data()), program.size());
 
-    if (SDL_Init(SDL_INIT_EVENTS | SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0)
+    if (SDL_Init(SDL_INIT_EVENTS | SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_AUDIO) < 0)
     {
         puts("Failed to initialize SDL2!");
         return 1;
@@ -284,6 +903,46 @@ int main(int argc, char** argv)
     atexit(TTF_Quit);
 
     Application application(program);
+    if (liveAssembler)
+        application.WatchSource(livePath, std::move(liveAssembler));
+    if (nativeProgram)
+        application.UseNativeProgram(std::move(nativeProgram));
+    application.SetInputLead(inputLead);
+    application.SetRunAhead(runAhead);
+    if (debugger)
+        application.Debug(std::move(debugger));
+    if (tracePath)
+    {
+        auto tracer = std::make_unique<Tracer>();
+        if (!tracer->Open(tracePath))
+            return 1;
+        application.Trace(std::move(tracer));
+    }
+
+    if (playPath)
+    {
+        Movie movie;
+        if (!LoadMovie(playPath, movie))
+            return 1;
+
+        auto player = std::make_unique<MoviePlayer>(std::move(movie));
+        if (!player->Matches(program))
+        {
+            puts("ERROR: the movie was recorded with a different program");
+            return 1;
+        }
+        application.SetRandomSeed(player->GetSeed());
+        application.Play(std::move(player));
+    }
+    else
+    {
+        uint32_t seed = static_cast<uint32_t>(time(nullptr));
+
+        application.SetRandomSeed(seed);
+        if (recordPath)
+            application.Record(recordPath, std::make_unique<MovieRecorder>(program, seed));
+    }
+
     application.Run();
 
     return 0;
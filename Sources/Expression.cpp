@@ -0,0 +1,283 @@
+#include "Expression.h"
+#include "ExpressionParser.h"
+#include "Assembler.h"
+
+using Op = ExpressionNode::Op;
+
+/**
+ * Check if a character can start an operator or parenthesis
+ * @param c Character to check
+ * @return True if c ends a name or number inside an expression
+ */
+bool IsExpressionOperator(char c)
+{
+    switch (c)
+    {
+    case '+': case '-': case '*': case '/':
+    case '&': case '|': case '^': case '<': case '>':
+    case '(': case ')':
+        return true;
+    }
+    return false;
+}
+
+static inline bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* Node operator of each binary operator the assembler supports */
+static Op GetNodeOp(ExpressionOperator op)
+{
+    switch (op)
+    {
+    case ExpressionOperator::Or:         return Op::Or;
+    case ExpressionOperator::Xor:        return Op::Xor;
+    case ExpressionOperator::And:        return Op::And;
+    case ExpressionOperator::ShiftLeft:  return Op::ShiftLeft;
+    case ExpressionOperator::ShiftRight: return Op::ShiftRight;
+    case ExpressionOperator::Add:        return Op::Add;
+    case ExpressionOperator::Subtract:   return Op::Subtract;
+    case ExpressionOperator::Multiply:   return Op::Multiply;
+    case ExpressionOperator::Divide:     return Op::Divide;
+    }
+    return Op::Constant;
+}
+
+/**
+ * Apply a binary operator
+ * @return False on division by zero
+ */
+static bool Apply(Op op, int a, int b, int& result)
+{
+    switch (op)
+    {
+    case Op::Add:        result = a + b; break;
+    case Op::Subtract:   result = a - b; break;
+    case Op::Multiply:   result = a * b; break;
+    case Op::And:        result = a & b; break;
+    case Op::Or:         result = a | b; break;
+    case Op::Xor:        result = a ^ b; break;
+    case Op::ShiftLeft:  result = static_cast<int>(static_cast<unsigned>(a) << (b & 31)); break;
+    case Op::ShiftRight: result = a >> (b & 31); break;
+    case Op::Divide:
+        if (b == 0)
+            return false;
+        result = a / b;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Builds the nodes of an assembler expression, folding every subexpression
+ * whose operands are already known, so only symbol-dependent nodes reach
+ * the arena
+ */
+class NodeBuilder
+{
+public:
+    using Node = int;
+
+    NodeBuilder(AssemblerState& state, const Token& token)
+        : m_State(state), m_Token(token), m_Ok(true), m_Symbol(-1), m_Symbolic(false)
+    {
+
+    }
+
+    bool IsOk() const { return m_Ok; }
+    int GetSymbol() const { return m_Symbol; }
+    bool IsSymbolic() const { return m_Symbolic; }
+
+    static bool IsNameChar(char c) { return !IsSpace(c) && !IsExpressionOperator(c); }
+    static bool IsUnaryOperator(char c) { return c == '-'; }
+    static char GetClosing(char open) { return (open == '(') ? ')' : '\0'; }
+    static bool Accepts(ExpressionOperator op) { return GetNodeOp(op) != Op::Constant; }
+
+    template <typename ...Args>
+    void Error(size_t position, const char* fmt, Args... args)
+    {
+        if (m_Ok)
+            AssemblerError(m_Token.line, m_Token.column + static_cast<int>(position), fmt, args...);
+        m_Ok = false;
+    }
+
+    int Constant(int value)
+    {
+        return Add(Op::Constant, value);
+    }
+
+    int Name(std::string_view name, size_t position)
+    {
+        int id = m_State.symbols.Intern(name);
+        m_Symbolic = true;
+        if (id == m_State.here)
+            return Add(Op::Constant, m_State.address);
+        if (m_State.symbols.IsDefined(id))
+            return Add(Op::Constant, m_State.symbols.GetValue(id));
+
+        if (m_Symbol == -1)
+            m_Symbol = id;
+        return Add(Op::Symbol, id);
+    }
+
+    int Unary(char op, int node)
+    {
+        if (IsConstant(node))
+        {
+            m_State.expressions[node].value = -m_State.expressions[node].value;
+            return node;
+        }
+        return Add(Op::Negate, 0, node);
+    }
+
+    int Binary(ExpressionOperator op, int left, int right, size_t position)
+    {
+        if (!IsConstant(left) || !IsConstant(right))
+            return Add(GetNodeOp(op), 0, left, right);
+
+        /* Both sides folded to single nodes, the right one directly after the left */
+        int result = 0;
+        if (!Apply(GetNodeOp(op), m_State.expressions[left].value, m_State.expressions[right].value, result))
+            Error(position, "division by zero");
+        m_State.expressions.resize(left + 1);
+        m_State.expressions[left].value = result;
+        return left;
+    }
+
+    int Group(char open, int inner)
+    {
+        return inner;
+    }
+private:
+    AssemblerState&  m_State;
+    const Token&     m_Token;
+    bool             m_Ok;
+    int              m_Symbol;  // First symbol that was not defined yet
+    bool             m_Symbolic;
+
+    int Add(Op op, int value, int left = -1, int right = -1)
+    {
+        m_State.expressions.push_back({ op, value, left, right });
+        return static_cast<int>(m_State.expressions.size()) - 1;
+    }
+
+    bool IsConstant(int node) const
+    {
+        return m_State.expressions[node].op == Op::Constant;
+    }
+};
+
+/**
+ * Parse an expression operand, folding everything that is already known
+ * @param state  Assembler state, whose arena receives the nodes that could not be folded
+ * @param token  Expression token, optionally starting with '#'
+ * @param result Receives the value, or the root node to evaluate once all symbols are known
+ * @return True on success, false if the expression is malformed
+ */
+bool ParseExpression(AssemblerState& state, const Token& token, ExpressionValue& result)
+{
+    size_t mark = state.expressions.size();
+    NodeBuilder builder(state, token);
+    ExpressionParser<NodeBuilder> parser(builder, token.text, (!token.text.empty() && token.text[0] == '#') ? 1 : 0);
+    int node = parser.Parse();
+
+    result.symbol = builder.GetSymbol();
+    result.symbolic = builder.IsSymbolic();
+    if (!builder.IsOk())
+    {
+        state.expressions.resize(mark);
+        return false;
+    }
+
+    if (state.expressions[node].op == Op::Constant)
+    {
+        result.value = state.expressions[node].value;
+        result.root = -1;
+        state.expressions.resize(mark);
+    }
+    else
+    {
+        result.value = 0;
+        result.root = node;
+    }
+    return true;
+}
+
+/**
+ * Evaluate an expression that was deferred until all symbols were known
+ * @param state   Assembler state
+ * @param root    Root node
+ * @param value   Receives the value
+ * @param missing Receives the first undefined symbol, or -1 if evaluation failed
+ *                because of a division by zero
+ * @return True on success, false otherwise
+ */
+bool EvaluateExpression(const AssemblerState& state, int root, int& value, int& missing)
+{
+    const ExpressionNode& node = state.expressions[root];
+    int left = 0;
+    int right = 0;
+
+    missing = -1;
+    switch (node.op)
+    {
+    case Op::Constant:
+        value = node.value;
+        return true;
+    case Op::Symbol:
+        if (!state.symbols.IsDefined(node.value))
+        {
+            missing = node.value;
+            return false;
+        }
+        value = state.symbols.GetValue(node.value);
+        return true;
+    case Op::Negate:
+        if (!EvaluateExpression(state, node.left, left, missing))
+            return false;
+        value = -left;
+        return true;
+    }
+
+    if (!EvaluateExpression(state, node.left, left, missing)
+        || !EvaluateExpression(state, node.right, right, missing))
+        return false;
+
+    return Apply(node.op, left, right, value);
+}
+
+/**
+ * Intern every name used in an expression without evaluating it
+ * @param text     Expression text
+ * @param symbols  Symbol table
+ * @param ids      Receives the symbol ids
+ * @param usesHere Set if the expression uses '$'
+ */
+void CollectExpressionSymbols(std::string_view text, SymbolTable& symbols, std::vector<int>& ids, bool& usesHere)
+{
+    size_t i = (!text.empty() && text[0] == '#') ? 1 : 0;
+
+    while (i < text.size())
+    {
+        if (IsSpace(text[i]) || IsExpressionOperator(text[i]))
+        {
+            ++i;
+            continue;
+        }
+
+        size_t start = i;
+        while (i < text.size() && !IsSpace(text[i]) && !IsExpressionOperator(text[i]))
+            ++i;
+
+        std::string_view name = text.substr(start, i - start);
+        if (name[0] >= '0' && name[0] <= '9')
+            continue;
+        else if (name == "$")
+            usesHere = true;
+        else
+            ids.push_back(symbols.Intern(name));
+    }
+}
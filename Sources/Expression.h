@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+struct AssemblerState;
+struct Token;
+class SymbolTable;
+
+/* A node of an expression that could not be folded to a constant */
+struct ExpressionNode
+{
+    enum class Op : uint8_t
+    {
+        Constant,   // value
+        Symbol,     // value is the symbol id
+        Negate,     // -left
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        And,
+        Or,
+        Xor,
+        ShiftLeft,
+        ShiftRight
+    };
+
+    Op  op;
+    int value;
+    int left;   // Node indices into AssemblerState::expressions
+    int right;
+};
+
+/* Result of parsing an expression operand */
+struct ExpressionValue
+{
+    int  value;     // Value, when the expression folded to a constant
+    int  root;      // Root node to evaluate later, or -1 if it folded
+    int  symbol;    // First symbol that was not defined yet, or -1
+    bool symbolic;  // Uses a symbol or '$', so the value depends on the program layout
+};
+
+bool ParseExpression(AssemblerState& state, const Token& token, ExpressionValue& result);
+bool EvaluateExpression(const AssemblerState& state, int root, int& value, int& missing);
+void CollectExpressionSymbols(std::string_view text, SymbolTable& symbols, std::vector<int>& ids, bool& usesHere);
+bool IsExpressionOperator(char c);
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "Tokenizer.h"
+
+/* Binary operators of the expression languages, a builder picks the ones it supports */
+enum class ExpressionOperator : uint8_t
+{
+    None,
+    LogicalOr,
+    LogicalAnd,
+    Or,
+    Xor,
+    And,
+    Equal,
+    NotEqual,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    ShiftLeft,
+    ShiftRight,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Modulo
+};
+
+/* Binding strength of each binary operator, higher binds tighter, like C */
+inline int GetPrecedence(ExpressionOperator op)
+{
+    switch (op)
+    {
+    case ExpressionOperator::LogicalOr:    return 1;
+    case ExpressionOperator::LogicalAnd:   return 2;
+    case ExpressionOperator::Or:           return 3;
+    case ExpressionOperator::Xor:          return 4;
+    case ExpressionOperator::And:          return 5;
+    case ExpressionOperator::Equal:
+    case ExpressionOperator::NotEqual:     return 6;
+    case ExpressionOperator::Less:
+    case ExpressionOperator::LessEqual:
+    case ExpressionOperator::Greater:
+    case ExpressionOperator::GreaterEqual: return 7;
+    case ExpressionOperator::ShiftLeft:
+    case ExpressionOperator::ShiftRight:   return 8;
+    case ExpressionOperator::Add:
+    case ExpressionOperator::Subtract:     return 9;
+    case ExpressionOperator::Multiply:
+    case ExpressionOperator::Divide:
+    case ExpressionOperator::Modulo:       return 10;
+    }
+    return 0;
+}
+
+/**
+ * Read the binary operator at a position without consuming it
+ * @param text   Expression text
+ * @param pos    Position of the operator
+ * @param length Receives the number of characters in the operator
+ * @return The operator, or None if there is none at pos
+ */
+inline ExpressionOperator ReadOperator(std::string_view text, size_t pos, size_t& length)
+{
+    char first = (pos < text.size()) ? text[pos] : '\0';
+    char second = (pos + 1 < text.size()) ? text[pos + 1] : '\0';
+
+    length = 2;
+    switch (first)
+    {
+    case '|': if (second == '|') return ExpressionOperator::LogicalOr; break;
+    case '&': if (second == '&') return ExpressionOperator::LogicalAnd; break;
+    case '=': return (second == '=') ? ExpressionOperator::Equal : ExpressionOperator::None;
+    case '!': return (second == '=') ? ExpressionOperator::NotEqual : ExpressionOperator::None;
+    case '<':
+        if (second == '<')
+            return ExpressionOperator::ShiftLeft;
+        if (second == '=')
+            return ExpressionOperator::LessEqual;
+        break;
+    case '>':
+        if (second == '>')
+            return ExpressionOperator::ShiftRight;
+        if (second == '=')
+            return ExpressionOperator::GreaterEqual;
+        break;
+    }
+
+    length = 1;
+    switch (first)
+    {
+    case '|': return ExpressionOperator::Or;
+    case '^': return ExpressionOperator::Xor;
+    case '&': return ExpressionOperator::And;
+    case '<': return ExpressionOperator::Less;
+    case '>': return ExpressionOperator::Greater;
+    case '+': return ExpressionOperator::Add;
+    case '-': return ExpressionOperator::Subtract;
+    case '*': return ExpressionOperator::Multiply;
+    case '/': return ExpressionOperator::Divide;
+    case '%': return ExpressionOperator::Modulo;
+    }
+    return ExpressionOperator::None;
+}
+
+/**
+ * Precedence-climbing parser shared by the assembler expressions and the
+ * debugger conditions. It only reads the text, everything it finds is
+ * handed to a builder in evaluation order, which decides what to make of it:
+ *
+ *   using Node                                     Whatever the builder returns for a value
+ *   static bool IsNameChar(char c)                 Characters that make up names and numbers
+ *   static bool IsUnaryOperator(char c)            Prefix operators besides '+'
+ *   static char GetClosing(char open)              Closing bracket of a group, '\0' if c opens none
+ *   static bool Accepts(ExpressionOperator op)     Binary operators of the language
+ *   Node Constant(int value)
+ *   Node Name(std::string_view name, size_t position)
+ *   Node Unary(char op, Node operand)
+ *   Node Binary(ExpressionOperator op, Node left, Node right, size_t position)
+ *   Node Group(char open, Node inner)
+ *   void Error(size_t position, const char* fmt, ...)
+ *   bool IsOk() const
+ */
+template <class Builder>
+class ExpressionParser
+{
+public:
+    using Node = typename Builder::Node;
+
+    ExpressionParser(Builder& builder, std::string_view text, size_t pos = 0)
+        : m_Builder(builder), m_Text(text), m_Pos(pos)
+    { }
+
+    Node Parse()
+    {
+        Node root = ParseBinary(1);
+
+        SkipSpaces();
+        if (m_Builder.IsOk() && m_Pos < m_Text.size())
+            m_Builder.Error(m_Pos, "unexpected '%c' in expression", m_Text[m_Pos]);
+        return root;
+    }
+private:
+    Builder&         m_Builder;
+    std::string_view m_Text;
+    size_t           m_Pos;
+
+    void SkipSpaces()
+    {
+        while (m_Pos < m_Text.size() && (m_Text[m_Pos] == ' ' || m_Text[m_Pos] == '\t'))
+            ++m_Pos;
+    }
+
+    Node ParsePrimary()
+    {
+        SkipSpaces();
+        if (m_Pos >= m_Text.size())
+        {
+            m_Builder.Error(m_Pos, "expected a value at the end of the expression");
+            return m_Builder.Constant(0);
+        }
+
+        char c = m_Text[m_Pos];
+        if (char close = Builder::GetClosing(c))
+        {
+            ++m_Pos;
+            Node inner = ParseBinary(1);
+            SkipSpaces();
+            if (m_Pos >= m_Text.size() || m_Text[m_Pos] != close)
+                m_Builder.Error(m_Pos, "expected '%c'", close);
+            ++m_Pos;
+            return m_Builder.Group(c, inner);
+        }
+        else if (Builder::IsUnaryOperator(c))
+        {
+            ++m_Pos;
+            return m_Builder.Unary(c, ParsePrimary());
+        }
+        else if (c == '+')
+        {
+            ++m_Pos;
+            return ParsePrimary();
+        }
+
+        size_t start = m_Pos;
+        while (m_Pos < m_Text.size() && Builder::IsNameChar(m_Text[m_Pos]))
+            ++m_Pos;
+
+        std::string_view name = m_Text.substr(start, m_Pos - start);
+        int value = 0;
+
+        if (name.empty())
+        {
+            m_Builder.Error(m_Pos, "unexpected '%c' in expression", c);
+            return m_Builder.Constant(0);
+        }
+        else if (name[0] >= '0' && name[0] <= '9')
+        {
+            if (!ParseInteger(name, value))
+                m_Builder.Error(start, "invalid number '%.*s'", (int)name.size(), name.data());
+            return m_Builder.Constant(value);
+        }
+        return m_Builder.Name(name, start);
+    }
+
+    Node ParseBinary(int minPrecedence)
+    {
+        Node left = ParsePrimary();
+        ExpressionOperator op;
+        size_t length;
+
+        for (SkipSpaces(); m_Builder.IsOk(); SkipSpaces())
+        {
+            op = ReadOperator(m_Text, m_Pos, length);
+            if (op == ExpressionOperator::None || !Builder::Accepts(op) || GetPrecedence(op) < minPrecedence)
+                break;
+
+            size_t position = m_Pos;
+            m_Pos += length;
+
+            Node right = ParseBinary(GetPrecedence(op) + 1);
+            left = m_Builder.Binary(op, left, right, position);
+        }
+
+        return left;
+    }
+};
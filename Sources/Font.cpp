@@ -26,6 +26,39 @@ int Font::GetHeight() const
     return TTF_FontHeight(m_Font);
 }
 
+int Font::GetCharWidth() const
+{
+    int width = 0;
+    int height = 0;
+
+    /* Only meaningful for fixed-width fonts like the debug font */
+    TTF_SizeText(m_Font, "0", &width, &height);
+    return width;
+}
+
+/**
+ * Render text into a new texture owned by the caller, bypassing the text cache
+ * @param text  Text to render
+ * @param fg    Foreground color
+ * @param bg    Background color
+ * @param width Receives the width of the texture in pixels
+ * @return The texture, or nullptr if nothing could be rendered
+ */
+SDL_Texture* Font::RenderText(const std::string& text, const SDL_Color& fg, const SDL_Color& bg, int& width)
+{
+    SDL_Surface* surface = TTF_RenderText_Shaded(m_Font, text.c_str(), fg, bg);
+    SDL_Texture* texture = nullptr;
+
+    width = 0;
+    if (surface == nullptr)
+        return nullptr;
+
+    texture = SDL_CreateTextureFromSurface(m_Renderer, surface);
+    width = surface->w;
+    SDL_FreeSurface(surface);
+    return texture;
+}
+
 void Font::DrawText(const std::string& text, int x, int y, const SDL_Color& fg, const SDL_Color& bg)
 {
     SDL_Texture* texture = nullptr;
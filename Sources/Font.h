@@ -16,6 +16,8 @@ public:
     ~Font();
 
     int GetHeight() const;
+    int GetCharWidth() const;
+    SDL_Texture* RenderText(const std::string& text, const SDL_Color& fg, const SDL_Color& bg, int& width);
     void DrawText(const std::string& text, int x, int y, const SDL_Color& fg, const SDL_Color& bg);
 private:
     struct FontTexture
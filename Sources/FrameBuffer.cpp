@@ -0,0 +1,35 @@
+#include "FrameBuffer.h"
+
+FrameBuffer::FrameBuffer()
+{
+    std::fill_n(m_Pixels.begin(), m_Pixels.size(), 0);
+}
+
+/**
+ * Convert the display of a core to pixels if it changed since the last call
+ * @param core Core to read the display from
+ * @return True if the pixels changed, false otherwise
+ */
+bool FrameBuffer::Update(Core& core)
+{
+    if (!core.TakeDisplayChange())
+        return false;
+
+    const auto& bitmap = core.GetDisplayBitmap();
+    for (int i = 0; i < Core::DisplayWidth * Core::DisplayHeight; i++)
+    {
+        int pixel = i * 4;
+        int bit = 1 << (i % 8);
+        int byte = i / 8;
+        int color = 0;
+
+        if (bitmap[byte] & bit)
+            color = 255;
+
+        m_Pixels[pixel] = color;
+        m_Pixels[pixel + 1] = color;
+        m_Pixels[pixel + 2] = color;
+        m_Pixels[pixel + 3] = 255;
+    }
+    return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include "Core.h"
+
+/* RGBA pixels of a core's display, kept by the host so the core stays cheap to copy */
+class FrameBuffer
+{
+public:
+    FrameBuffer();
+
+    bool Update(Core& core);
+    const auto& GetPixels() const { return m_Pixels; }
+private:
+    std::array<uint8_t, Core::DisplayWidth * Core::DisplayHeight * 4> m_Pixels;
+};
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include "IncrementalAssembler.h"
+#include "Core.h"
+
+IncrementalAssembler::IncrementalAssembler(int origin)
+    : m_State(origin)
+{
+
+}
+
+/**
+ * Tokenize one line into a new cache entry and intern its symbols
+ * @param text  Line text, without its line break
+ * @param nLine Line number, counting from 1
+ * @param ok    Cleared if the line has a syntax error
+ * @return The line
+ */
+std::unique_ptr<IncrementalAssembler::Line> IncrementalAssembler::ParseLine(std::string_view text, int nLine, bool& ok)
+{
+    auto line = std::make_unique<Line>();
+
+    line->text = text;
+    line->address = -1;
+    line->usesHere = false;
+    line->dirty = true;
+
+    if (!TokenizeLine(line->tokens, nLine, line->text))
+        ok = false;
+
+    for (Token& token : line->tokens)
+    {
+        if (token.type == Token::Type::Expression)
+            CollectExpressionSymbols(token.text, m_State.symbols, line->references, line->usesHere);
+        if (token.type != Token::Type::Label && token.type != Token::Type::Identifier)
+            continue;
+
+        token.symbol = m_State.symbols.Intern(token.text);
+        if (token.type == Token::Type::Identifier)
+        {
+            if (token.symbol == m_State.here)
+                line->usesHere = true;
+            else
+                line->references.push_back(token.symbol);
+        }
+    }
+
+    return line;
+}
+
+/**
+ * Assemble one line at its address with the current symbol values
+ * @param line Line to emit
+ * @return True on success, false otherwise. Symbols without a value are left in m_State.fixups.
+ */
+bool IncrementalAssembler::EmitLine(Line& line)
+{
+    m_State.address = line.address;
+    m_State.fixups.clear();
+    m_State.expressions.clear();
+    line.bytes.clear();
+
+    return AssembleTokens(line.bytes, m_State, line.tokens.data(), line.tokens.size());
+}
+
+/**
+ * Rebuild the program from a new version of the source
+ * @param code New source
+ * @return True on success, in which case GetPatches() holds the bytes that
+ *         changed. On failure the previous program and patches are kept.
+ */
+bool IncrementalAssembler::Update(std::string_view code)
+{
+    std::vector<std::string_view> text;
+    size_t start = 0;
+
+    while (start < code.size())
+    {
+        size_t end = code.find('\n', start);
+        if (end == std::string_view::npos)
+            end = code.size();
+        text.push_back(code.substr(start, end - start));
+        start = end + 1;
+    }
+
+    /* Lines outside the edited range keep their tokens */
+    size_t prefix = 0;
+    while (prefix < text.size() && prefix < m_Lines.size() && m_Lines[prefix]->text == text[prefix])
+        ++prefix;
+
+    size_t suffix = 0;
+    while (suffix < text.size() - prefix && suffix < m_Lines.size() - prefix
+        && m_Lines[m_Lines.size() - 1 - suffix]->text == text[text.size() - 1 - suffix])
+        ++suffix;
+
+    std::vector<std::unique_ptr<Line>> edited;
+    bool ok = true;
+
+    for (size_t i = prefix; i < text.size() - suffix; i++)
+        edited.push_back(ParseLine(text[i], static_cast<int>(i) + 1, ok));
+
+    if (!ok)
+        return false;
+
+    int shift = static_cast<int>(text.size()) - static_cast<int>(m_Lines.size());
+    if (shift != 0)
+    {
+        for (size_t i = m_Lines.size() - suffix; i < m_Lines.size(); i++)
+        {
+            for (Token& token : m_Lines[i]->tokens)
+                token.line += shift;
+        }
+    }
+
+    /* Keep the replaced lines and the old layout so that a failed build can be undone */
+    std::vector<std::unique_ptr<Line>> removed(std::make_move_iterator(m_Lines.begin() + prefix), std::make_move_iterator(m_Lines.end() - suffix));
+    size_t insertedCount = edited.size();
+
+    m_Lines.erase(m_Lines.begin() + prefix, m_Lines.end() - suffix);
+    m_Lines.insert(m_Lines.begin() + prefix, std::make_move_iterator(edited.begin()), std::make_move_iterator(edited.end()));
+
+    std::vector<int> addresses(m_Lines.size());
+    for (size_t i = 0; i < m_Lines.size(); i++)
+        addresses[i] = m_Lines[i]->address;
+
+    std::vector<std::pair<Line*, std::vector<uint8_t>>> saved;    // Output of the unchanged lines that get re-emitted
+
+    auto rollback = [&]()
+    {
+        for (auto& [line, bytes] : saved)
+        {
+            line->bytes = std::move(bytes);
+            line->dirty = false;
+        }
+        for (size_t i = 0; i < m_Lines.size(); i++)
+            m_Lines[i]->address = addresses[i];
+        for (size_t i = m_Lines.size() - suffix; i < m_Lines.size(); i++)
+        {
+            for (Token& token : m_Lines[i]->tokens)
+                token.line -= shift;
+        }
+
+        m_Lines.erase(m_Lines.begin() + prefix, m_Lines.begin() + prefix + insertedCount);
+        m_Lines.insert(m_Lines.begin() + prefix, std::make_move_iterator(removed.begin()), std::make_move_iterator(removed.end()));
+
+        for (size_t id = 0; id < m_State.symbols.GetCount(); id++)
+            m_State.symbols.SetValue(static_cast<int>(id), (id < m_Values.size()) ? m_Values[id] : SymbolTable::Undefined);
+    };
+
+    /* Emit new lines once from address 0 to learn their size and label offsets */
+    for (auto& line : m_Lines)
+    {
+        if (line->address != -1)
+            continue;
+
+        line->address = 0;
+        if (!EmitLine(*line))
+        {
+            rollback();
+            return false;
+        }
+
+        for (const Token& token : line->tokens)
+        {
+            if (token.type == Token::Type::Label)
+                line->labels.emplace_back(token.symbol, m_State.symbols.GetValue(token.symbol));
+        }
+        line->address = -1;
+    }
+
+    /* Lay out every line and find the symbols whose value moved */
+    size_t symbolCount = m_State.symbols.GetCount();
+    std::vector<int>  values(symbolCount, SymbolTable::Undefined);
+    std::vector<bool> moved(m_Lines.size(), false);
+    int address = m_State.origin;
+
+    m_Values.resize(symbolCount, SymbolTable::Undefined);
+    for (size_t i = 0; i < m_Lines.size(); i++)
+    {
+        Line& line = *m_Lines[i];
+
+        moved[i] = line.address != address;
+        line.address = address;
+        for (const auto& [id, offset] : line.labels)
+            values[id] = address + offset;
+        address += static_cast<int>(line.bytes.size());
+    }
+
+    std::vector<bool> changed(symbolCount, false);
+    for (size_t id = 0; id < symbolCount; id++)
+    {
+        changed[id] = values[id] != m_Values[id];
+        m_State.symbols.SetValue(static_cast<int>(id), values[id]);
+    }
+
+    /* Re-emit edited lines and the lines that depend on something that moved */
+    for (size_t i = 0; i < m_Lines.size(); i++)
+    {
+        Line& line = *m_Lines[i];
+        bool stale = line.dirty || (line.usesHere && moved[i])
+            || std::any_of(line.references.begin(), line.references.end(), [&](int id) { return changed[id]; });
+
+        if (!stale)
+            continue;
+
+        if (!line.dirty)
+            saved.emplace_back(&line, line.bytes);
+
+        /* Every label is laid out by now, so a fixup means the symbol does not exist */
+        bool emitted = EmitLine(line);
+        for (const Fixup& fixup : m_State.fixups)
+        {
+            std::string_view name = m_State.symbols.GetName(fixup.symbol);
+            AssemblerError(fixup.line, fixup.column, "use of undeclared identifier '%.*s'", (int)name.size(), name.data());
+            emitted = false;
+        }
+
+        line.dirty = !emitted;
+        if (!emitted)
+            ok = false;
+    }
+
+    if (!ok)
+    {
+        rollback();
+        return false;
+    }
+
+    /* Diff against the previous build; bytes past the end of a shorter program become zero */
+    std::vector<uint8_t> program;
+    program.reserve(address - m_State.origin);
+    for (const auto& line : m_Lines)
+        program.insert(program.end(), line->bytes.begin(), line->bytes.end());
+
+    size_t length = std::max(program.size(), m_Program.size());
+    m_Patches.clear();
+    for (size_t i = 0; i < length; )
+    {
+        auto byteAt = [&](const std::vector<uint8_t>& bytes) { return (i < bytes.size()) ? bytes[i] : 0; };
+
+        if (byteAt(program) == byteAt(m_Program))
+        {
+            ++i;
+            continue;
+        }
+
+        size_t first = i;
+        while (i < length && byteAt(program) != byteAt(m_Program))
+            ++i;
+        m_Patches.push_back({ static_cast<uint16_t>(m_State.origin + first), static_cast<uint16_t>(i - first) });
+    }
+
+    m_Program = std::move(program);
+    m_Values = std::move(values);
+    return true;
+}
+
+/**
+ * Write the bytes that changed in the last build into a running core
+ * @param core Core that is running the previous build
+ */
+void IncrementalAssembler::ApplyPatches(Core& core) const
+{
+    for (const AssemblerPatch& patch : m_Patches)
+    {
+        size_t offset = patch.address - m_State.origin;
+        size_t end = offset + patch.length;
+
+        auto byteAt = [&](size_t i) -> uint8_t { return (i < m_Program.size()) ? m_Program[i] : 0; };
+
+        for (; offset + 1 < end; offset += 2)
+            core.WriteWord(static_cast<uint16_t>(m_State.origin + offset), (byteAt(offset) << 8) | byteAt(offset + 1));
+        if (offset < end)
+            core.WriteByte(static_cast<uint16_t>(m_State.origin + offset), byteAt(offset));
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Assembler.h"
+
+class Core;
+
+/* A run of program bytes that changed in the last build */
+struct AssemblerPatch
+{
+    uint16_t address;
+    uint16_t length;
+};
+
+/**
+ * Assembler that keeps the tokens and output of every source line between
+ * builds. An edit only re-tokenizes the lines that changed and only
+ * re-emits the lines whose symbols moved, and the result is a byte diff
+ * that can be written into a running Core.
+ */
+class IncrementalAssembler
+{
+public:
+    IncrementalAssembler(int origin = 0x200);
+
+    bool Update(std::string_view code);
+    void ApplyPatches(Core& core) const;
+
+    const std::vector<uint8_t>& GetProgram() const { return m_Program; }
+    const std::vector<AssemblerPatch>& GetPatches() const { return m_Patches; }
+private:
+    struct Line
+    {
+        std::string          text;       // Owned copy of the line, the tokens point into it
+        std::vector<Token>   tokens;
+        std::vector<uint8_t> bytes;
+        std::vector<std::pair<int, int>> labels;    // Symbol id and offset from the start of the line
+        std::vector<int>     references; // Symbol ids used as operands
+        int                  address;
+        bool                 usesHere;
+        bool                 dirty;      // Tokens changed since the line was last emitted
+    };
+
+    AssemblerState                     m_State;
+    std::vector<std::unique_ptr<Line>> m_Lines;
+    std::vector<int>                   m_Values;   // Symbol values of the last successful build
+    std::vector<uint8_t>               m_Program;
+    std::vector<AssemblerPatch>        m_Patches;
+
+    std::unique_ptr<Line> ParseLine(std::string_view text, int nLine, bool& ok);
+    bool EmitLine(Line& line);
+};
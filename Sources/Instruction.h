@@ -1,11 +1,13 @@
 #pragma once
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
+#include <string>
 
 struct Instruction
 {
-    enum class Encoding : uint32_t
+    enum class Encoding : uint8_t
     {
         None,
         Address,
@@ -15,7 +17,7 @@ struct Instruction
         DestinationSourceNibble
     };
 
-    enum class Type : uint32_t
+    enum class Type : uint8_t
     {
         UNKNOWN = 0,
         CLS,
@@ -48,6 +50,8 @@ struct Instruction
         LD_DT_V,
         LD_ST_V,
         ADD_I_V,
+        LD_AUDIO_I,     // XO-CHIP F002
+        LD_PITCH_V,     // XO-CHIP Fx3A
         _END
     };
 
@@ -84,25 +88,36 @@ struct Instruction
             "LD",
             "LD",
             "LD",
-            "ADD"
+            "ADD",
+            "LD",
+            "LD"
         };
         return InstructionNames[(int)type];
     }
 
     uint16_t instruction;
-    uint16_t address;
-    uint8_t  opcode;
-    uint8_t  dst;
-    uint8_t  src;
-    uint8_t  byte;
     Type     type;
     Encoding encoding;
 
     Instruction() = default;
-    Instruction(uint16_t _instruction)
-        : type(Type::UNKNOWN), encoding(Encoding::None)
+    constexpr Instruction(uint16_t _instruction);
+
+    /* Operands are bit fields of the instruction word */
+    constexpr uint16_t GetAddress() const { return instruction & 0xFFF; }
+    constexpr uint8_t GetOpcode() const { return instruction >> 12; }
+    constexpr uint8_t GetDst() const { return (instruction >> 8) & 0xF; }
+    constexpr uint8_t GetSrc() const { return (instruction >> 4) & 0xF; }
+    constexpr uint8_t GetByte() const { return instruction & 0xFF; }
+
+    /**
+     * Work out the type and encoding of an instruction word, which only
+     * depend on its opcode nibble and low byte, apart from F002
+     * @param instruction Instruction word
+     * @return Instruction with the type and encoding filled in
+     */
+    static constexpr Instruction Classify(uint16_t instruction)
     {
-        static constexpr Type aluLookup[16] = {
+        constexpr Type aluLookup[16] = {
             Type::LD, Type::OR, Type::AND,
             Type::XOR, Type::ADD, Type::SUB,
             Type::SHR, Type::SUBN, Type::UNKNOWN,
@@ -110,121 +125,126 @@ struct Instruction
             Type::UNKNOWN, Type::UNKNOWN, Type::SHL
         };
 
-        static constexpr Type ctrlLookup[128] = {
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::LD_V_DT, Type::UNKNOWN,
-                Type::UNKNOWN, Type::LD_V_K, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::LD_DT_V, Type::UNKNOWN, Type::UNKNOWN,
-                Type::LD_ST_V, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::ADD_I_V, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::LD_F_V,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::LD_B_V, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::LD_I_V0V, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::UNKNOWN,
-                Type::UNKNOWN, Type::UNKNOWN, Type::LD_V0V_I,
-        };
+        Instruction ins{ };
+        uint8_t byte = instruction & 0xFF;
 
-        instruction = _instruction;
-        address = instruction & 0xFFF;
-        opcode = instruction >> 12;
-        dst = (instruction >> 8) & 0xF;
-        src = (instruction >> 4) & 0xF;
-        byte = instruction & 0xFF;
+        ins.instruction = instruction;
+        ins.type = Type::UNKNOWN;
+        ins.encoding = Encoding::None;
 
-        switch (opcode)
+        switch (instruction >> 12)
         {
         case 0x0:
             if (byte == 0xE0)
-                type = Type::CLS;
+                ins.type = Type::CLS;
             else if (byte == 0xEE)
-                type = Type::RET;
+                ins.type = Type::RET;
             break;
         case 0x1:
-            type = Type::JP;
-            encoding = Encoding::Address;
+            ins.type = Type::JP;
+            ins.encoding = Encoding::Address;
             break;
         case 0x2:
-            type = Type::CALL;
-            encoding = Encoding::Address;
+            ins.type = Type::CALL;
+            ins.encoding = Encoding::Address;
             break;
         case 0x3:
-            type = Type::SE;
-            encoding = Encoding::DestinationByte;
+            ins.type = Type::SE;
+            ins.encoding = Encoding::DestinationByte;
             break;
         case 0x4:
-            type = Type::SNE;
-            encoding = Encoding::DestinationByte;
+            ins.type = Type::SNE;
+            ins.encoding = Encoding::DestinationByte;
             break;
         case 0x5:
-            type = Type::SE;
-            encoding = Encoding::DestinationSource;
+            ins.type = Type::SE;
+            ins.encoding = Encoding::DestinationSource;
             break;
         case 0x6:
-            type = Type::LD;
-            encoding = Encoding::DestinationByte;
+            ins.type = Type::LD;
+            ins.encoding = Encoding::DestinationByte;
             break;
         case 0x7:
-            type = Type::ADD;
-            encoding = Encoding::DestinationByte;
+            ins.type = Type::ADD;
+            ins.encoding = Encoding::DestinationByte;
             break;
         case 0x8:
-            type = aluLookup[byte & 0x0F];
-            encoding = Encoding::DestinationSource;
+            ins.type = aluLookup[byte & 0x0F];
+            ins.encoding = Encoding::DestinationSource;
             break;
         case 0x9:
-            type = Type::SNE;
-            encoding = Encoding::DestinationSource;
+            ins.type = Type::SNE;
+            ins.encoding = Encoding::DestinationSource;
             break;
         case 0xA:
-            type = Type::LD_I_IMM;
-            encoding = Encoding::Address;
+            ins.type = Type::LD_I_IMM;
+            ins.encoding = Encoding::Address;
             break;
         case 0xB:
-            type = Type::JP_V0_IMM;
-            encoding = Encoding::Address;
+            ins.type = Type::JP_V0_IMM;
+            ins.encoding = Encoding::Address;
             break;
         case 0xC:
-            type = Type::RND;
-            encoding = Encoding::DestinationByte;
+            ins.type = Type::RND;
+            ins.encoding = Encoding::DestinationByte;
             break;
         case 0xD:
-            type = Type::DRW;
-            encoding = Encoding::DestinationSourceNibble;
+            ins.type = Type::DRW;
+            ins.encoding = Encoding::DestinationSourceNibble;
             break;
         case 0xE:
             if (byte == 0x9E)
-                type = Type::SKP;
+                ins.type = Type::SKP;
             else if (byte == 0xA1)
-                type = Type::SKNP;
-            encoding = Encoding::Destination;
+                ins.type = Type::SKNP;
+            ins.encoding = Encoding::Destination;
             break;
         case 0xF:
-            type = ctrlLookup[byte & 0x7f];
-            encoding = Encoding::Destination;
+            /* The XO-CHIP words are matched exactly, F002 has no register operand */
+            if (byte == 0x02)
+                ins.type = ((instruction & 0x0F00) == 0) ? Type::LD_AUDIO_I : Type::UNKNOWN;
+            else if (byte == 0x3A)
+                ins.type = Type::LD_PITCH_V;
+            else switch (byte & 0x7F)
+            {
+            case 0x07: ins.type = Type::LD_V_DT; break;
+            case 0x0A: ins.type = Type::LD_V_K; break;
+            case 0x15: ins.type = Type::LD_DT_V; break;
+            case 0x18: ins.type = Type::LD_ST_V; break;
+            case 0x1E: ins.type = Type::ADD_I_V; break;
+            case 0x29: ins.type = Type::LD_F_V; break;
+            case 0x33: ins.type = Type::LD_B_V; break;
+            case 0x55: ins.type = Type::LD_I_V0V; break;
+            case 0x65: ins.type = Type::LD_V0V_I; break;
+            }
+            ins.encoding = Encoding::Destination;
             break;
         }
+        return ins;
     }
-};
\ No newline at end of file
+};
+
+static_assert(sizeof(Instruction) == 4, "Instruction should stay as small as the word it decodes");
+
+/*
+ * Type and encoding of every instruction word, indexed by its opcode nibble
+ * and low byte, which are the only bits that decide them apart from the X
+ * nibble of F002 that the constructor checks. 4096 entries of 4 bytes
+ * rather than 65536, so the table stays in L1 alongside the code.
+ */
+inline constexpr auto s_InstructionTable = [] {
+    std::array<Instruction, 4096> table{ };
+    for (int index = 0; index < static_cast<int>(table.size()); index++)
+        table[index] = Instruction::Classify(static_cast<uint16_t>(((index >> 8) << 12) | (index & 0xFF)));
+    return table;
+}();
+
+/* Decoding is a table load and a store of the word */
+constexpr Instruction::Instruction(uint16_t _instruction)
+    : instruction(_instruction),
+    type(s_InstructionTable[((_instruction >> 4) & 0xF00) | (_instruction & 0xFF)].type),
+    encoding(s_InstructionTable[((_instruction >> 4) & 0xF00) | (_instruction & 0xFF)].encoding)
+{
+    if (type == Type::LD_AUDIO_I && GetDst() != 0)
+        type = Type::UNKNOWN;
+}
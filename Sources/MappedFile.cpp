@@ -0,0 +1,155 @@
+#include <utility>
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile()
+    : m_File(INVALID_HANDLE_VALUE), m_Mapping(nullptr), m_Data(nullptr), m_Size(0), m_Open(false)
+{
+
+}
+#else
+MappedFile::MappedFile()
+    : m_File(-1), m_Data(nullptr), m_Size(0), m_Open(false)
+{
+
+}
+#endif
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+    : MappedFile()
+{
+    Open(path);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : MappedFile()
+{
+    *this = std::move(other);
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        std::swap(m_File, other.m_File);
+#ifdef _WIN32
+        std::swap(m_Mapping, other.m_Mapping);
+#endif
+        std::swap(m_Data, other.m_Data);
+        std::swap(m_Size, other.m_Size);
+        std::swap(m_Open, other.m_Open);
+    }
+    return *this;
+}
+
+/**
+ * Map a file into memory, replacing any file that was mapped before
+ * @param path Path of the file
+ * @return True on success, false otherwise. Empty files map to a null pointer.
+ */
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+    Close();
+
+#ifdef _WIN32
+    LARGE_INTEGER size = { };
+
+    m_File = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_File == INVALID_HANDLE_VALUE)
+        return false;
+
+    if (!GetFileSizeEx(m_File, &size))
+    {
+        Close();
+        return false;
+    }
+
+    m_Size = static_cast<size_t>(size.QuadPart);
+    if (m_Size != 0)
+    {
+        m_Mapping = CreateFileMappingW(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_Mapping == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        m_Data = static_cast<const uint8_t*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_Data == nullptr)
+        {
+            Close();
+            return false;
+        }
+    }
+#else
+    struct stat info = { };
+
+    m_File = open(path.c_str(), O_RDONLY);
+    if (m_File < 0)
+        return false;
+
+    if (fstat(m_File, &info) != 0)
+    {
+        Close();
+        return false;
+    }
+
+    m_Size = static_cast<size_t>(info.st_size);
+    if (m_Size != 0)
+    {
+        void* data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_File, 0);
+        if (data == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
+        m_Data = static_cast<const uint8_t*>(data);
+    }
+#endif
+
+    m_Open = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+    if (m_Data != nullptr)
+        UnmapViewOfFile(m_Data);
+    if (m_Mapping != nullptr)
+        CloseHandle(m_Mapping);
+    if (m_File != INVALID_HANDLE_VALUE)
+        CloseHandle(m_File);
+
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = nullptr;
+#else
+    if (m_Data != nullptr)
+        munmap(const_cast<uint8_t*>(m_Data), m_Size);
+    if (m_File >= 0)
+        close(m_File);
+
+    m_File = -1;
+#endif
+    m_Data = nullptr;
+    m_Size = 0;
+    m_Open = false;
+}
@@ -0,0 +1,209 @@
+#include "MemoryView.h"
+#include "Disassembler.h"
+
+static constexpr char s_HexDigits[] = "0123456789ABCDEF";
+static constexpr SDL_Color s_TextColor = { 250, 250, 250, 150 };
+static constexpr SDL_Color s_BackColor = { 45, 55, 70, 255 };
+static constexpr SDL_Color s_ChangedColor = { 255, 200, 60, 90 };
+static constexpr SDL_Color s_CursorColor = { 120, 160, 255, 60 };
+
+MemoryView::MemoryView(SDL_Renderer* renderer, Font& font)
+    : m_Renderer(renderer), m_Font(font), m_HexBase(0), m_CodeBase(0),
+    m_Frame(0), m_Synced(false), m_Shadow{ }, m_ChangedFrame{ }
+{
+
+}
+
+MemoryView::~MemoryView()
+{
+    ResizeRows(m_HexRows, 0);
+    ResizeRows(m_CodeRows, 0);
+}
+
+/**
+ * Pull the lines written since the last frame out of the core and note which
+ * of their bytes actually changed
+ */
+void MemoryView::SyncMemory(Core& core)
+{
+    if (!m_Synced)
+    {
+        /* The first frame takes a full copy without highlighting anything */
+        for (int address = 0; address < Core::MemorySize; address++)
+            m_Shadow[address] = core.ReadByte(address);
+
+        m_Dirty.set();
+        m_Synced = true;
+        core.ClearDirtyLines();
+        return;
+    }
+
+    m_Dirty = core.GetDirtyLines();
+    core.ClearDirtyLines();
+
+    if (m_Dirty.none())
+        return;
+
+    for (int line = 0; line < Core::MemoryLines; line++)
+    {
+        if (!m_Dirty[line])
+            continue;
+
+        for (int address = line * Core::MemoryLineSize; address < (line + 1) * Core::MemoryLineSize; address++)
+        {
+            uint8_t value = core.ReadByte(address);
+            if (value != m_Shadow[address])
+            {
+                m_Shadow[address] = value;
+                m_ChangedFrame[address] = m_Frame;
+            }
+        }
+    }
+}
+
+void MemoryView::ResizeRows(std::vector<Row>& rows, size_t count)
+{
+    for (size_t i = count; i < rows.size(); i++)
+    {
+        if (rows[i].texture != nullptr)
+            SDL_DestroyTexture(rows[i].texture);
+    }
+    rows.resize(count, Row{ -1, 0, nullptr });
+}
+
+void MemoryView::RenderRow(Row& row, int address, const std::string& text)
+{
+    if (row.texture != nullptr)
+        SDL_DestroyTexture(row.texture);
+
+    row.address = address;
+    row.texture = m_Font.RenderText(text, s_TextColor, s_BackColor, row.width);
+}
+
+void MemoryView::DrawRow(const Row& row, int x, int y)
+{
+    if (row.texture == nullptr)
+        return;
+
+    SDL_Rect rect = { x, y, row.width, m_Font.GetHeight() };
+    SDL_RenderCopy(m_Renderer, row.texture, nullptr, &rect);
+}
+
+void MemoryView::DrawHighlight(int x, int y, int w, int h, const SDL_Color& color)
+{
+    SDL_Rect rect = { x, y, w, h };
+    SDL_SetRenderDrawColor(m_Renderer, color.r, color.g, color.b, color.a);
+    SDL_RenderFillRect(m_Renderer, &rect);
+}
+
+/**
+ * Format one 16-byte line as "AAA WWWW WWWW ..."
+ */
+std::string MemoryView::FormatHexLine(int line) const
+{
+    int address = line * Core::MemoryLineSize;
+    std::string text(HexColumns, ' ');
+
+    text[0] = s_HexDigits[(address >> 8) & 0xF];
+    text[1] = s_HexDigits[(address >> 4) & 0xF];
+    text[2] = s_HexDigits[address & 0xF];
+
+    for (int i = 0; i < Core::MemoryLineSize; i++)
+    {
+        int column = 4 + (i / 2) * 5 + (i % 2) * 2;
+        text[column] = s_HexDigits[m_Shadow[address + i] >> 4];
+        text[column + 1] = s_HexDigits[m_Shadow[address + i] & 0xF];
+    }
+
+    return text;
+}
+
+/**
+ * Format the instruction at address as "AAA MNEMONIC OPERANDS"
+ */
+std::string MemoryView::FormatCodeLine(int address) const
+{
+    char buffer[4 + MaxDisassemblyLineLength] = { };
+    Instruction ins((m_Shadow[address] << 8) | m_Shadow[address + 1]);
+
+    buffer[0] = s_HexDigits[(address >> 8) & 0xF];
+    buffer[1] = s_HexDigits[(address >> 4) & 0xF];
+    buffer[2] = s_HexDigits[address & 0xF];
+    buffer[3] = ' ';
+    return std::string(buffer, 4 + FormatInstruction(buffer + 4, ins));
+}
+
+void MemoryView::Draw(Core& core, const SDL_Rect& rect)
+{
+    const int lineHeight = m_Font.GetHeight();
+    const int charWidth = m_Font.GetCharWidth();
+    const int rows = (lineHeight > 0) ? (rect.h / lineHeight) : 0;
+    const int codeX = rect.x + (HexColumns + 1) * charWidth;
+    const uint16_t ip = core.GetIP();
+    const int iLine = (core.GetI() % Core::MemorySize) / Core::MemoryLineSize;
+
+    ++m_Frame;
+    SyncMemory(core);
+
+    if (rows <= 0)
+        return;
+
+    /* Only scroll once I or IP leaves the window, so rows keep their textures */
+    if (iLine < m_HexBase || iLine >= m_HexBase + rows)
+        m_HexBase = std::clamp(iLine - rows / 2, 0, std::max(Core::MemoryLines - rows, 0));
+
+    if (ip < m_CodeBase || ip >= m_CodeBase + (rows - 2) * 2)
+        m_CodeBase = std::max(ip - (rows / 4) * 2, ip & 1);
+
+    ResizeRows(m_HexRows, rows);
+    ResizeRows(m_CodeRows, rows);
+
+    SDL_RenderSetClipRect(m_Renderer, &rect);
+    SDL_SetRenderDrawBlendMode(m_Renderer, SDL_BLENDMODE_BLEND);
+
+    for (int r = 0; r < rows; r++)
+    {
+        int y = rect.y + r * lineHeight;
+        int line = m_HexBase + r;
+        Row& row = m_HexRows[r];
+
+        if (line >= Core::MemoryLines)
+            continue;
+
+        if (row.address != line * Core::MemoryLineSize || m_Dirty[line])
+            RenderRow(row, line * Core::MemoryLineSize, FormatHexLine(line));
+        DrawRow(row, rect.x, y);
+
+        for (int i = 0; i < Core::MemoryLineSize; i++)
+        {
+            int address = line * Core::MemoryLineSize + i;
+            if (m_ChangedFrame[address] == 0 || m_Frame - m_ChangedFrame[address] >= HighlightFrames)
+                continue;
+
+            int column = 4 + (i / 2) * 5 + (i % 2) * 2;
+            DrawHighlight(rect.x + column * charWidth, y, charWidth * 2, lineHeight, s_ChangedColor);
+        }
+    }
+
+    for (int r = 0; r < rows; r++)
+    {
+        int y = rect.y + r * lineHeight;
+        int address = m_CodeBase + r * 2;
+        Row& row = m_CodeRows[r];
+
+        if (address + 1 >= Core::MemorySize)
+            continue;
+
+        if (row.address != address
+            || m_Dirty[address / Core::MemoryLineSize]
+            || m_Dirty[(address + 1) / Core::MemoryLineSize])
+            RenderRow(row, address, FormatCodeLine(address));
+        DrawRow(row, codeX, y);
+
+        if (address == ip)
+            DrawHighlight(codeX, y, rect.x + rect.w - codeX, lineHeight, s_CursorColor);
+    }
+
+    SDL_SetRenderDrawBlendMode(m_Renderer, SDL_BLENDMODE_NONE);
+    SDL_RenderSetClipRect(m_Renderer, nullptr);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <string>
+#include <vector>
+#include <SDL.h>
+
+#include "Core.h"
+#include "Font.h"
+
+/**
+ * Hex view of the memory around I next to a disassembly of the code around IP.
+ * Every visible row owns a texture that is only re-rendered when the memory
+ * behind it was written or the window scrolled, so the cost per frame is a
+ * handful of texture copies no matter how fast the core is running.
+ */
+class MemoryView
+{
+public:
+    MemoryView(SDL_Renderer* renderer, Font& font);
+    ~MemoryView();
+
+    void Draw(Core& core, const SDL_Rect& rect);
+private:
+    struct Row
+    {
+        int          address;
+        int          width;
+        SDL_Texture* texture;
+    };
+
+    constexpr static int HexColumns = 44;
+    constexpr static uint32_t HighlightFrames = 30;
+
+    SDL_Renderer* m_Renderer;
+    Font&         m_Font;
+    std::vector<Row> m_HexRows;
+    std::vector<Row> m_CodeRows;
+    int      m_HexBase;     // First line shown in the hex view
+    int      m_CodeBase;    // First address shown in the disassembly view
+    uint32_t m_Frame;
+    bool     m_Synced;
+
+    /* Lines written since the last frame, copied out of the core */
+    std::bitset<Core::MemoryLines> m_Dirty;
+
+    /* Memory as of the last frame, and the frame each byte last changed on */
+    std::array<uint8_t, Core::MemorySize>  m_Shadow;
+    std::array<uint32_t, Core::MemorySize> m_ChangedFrame;
+
+    void SyncMemory(Core& core);
+    void ResizeRows(std::vector<Row>& rows, size_t count);
+    void RenderRow(Row& row, int address, const std::string& text);
+    void DrawRow(const Row& row, int x, int y);
+    void DrawHighlight(int x, int y, int w, int h, const SDL_Color& color);
+
+    std::string FormatHexLine(int line) const;
+    std::string FormatCodeLine(int address) const;
+};
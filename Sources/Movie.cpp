@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include "Movie.h"
+#include "Core.h"
+
+/*
+ * File layout, all integers little-endian:
+ *
+ *   Header   "C8MV", version, ROM hash, seed, chunk count, length, index offset
+ *   Chunks   Events as varint((cycle delta << 2) | kind), followed by the key
+ *            for key events or the 32-bit checksum for checksum events
+ *   Index    First cycle, file offset and event count of every chunk
+ *
+ * Deltas restart at every chunk, so a reader can start decoding at any
+ * entry of the index.
+ */
+static constexpr char     s_Magic[4] = { 'C', '8', 'M', 'V' };
+static constexpr uint16_t MovieVersion = 1;
+static constexpr size_t   HeaderSize = 40;
+static constexpr size_t   IndexEntrySize = 16;
+static constexpr size_t   ChunkEvents = 256;
+
+template <typename T>
+static void PutInteger(std::vector<uint8_t>& out, T value)
+{
+    for (size_t i = 0; i < sizeof(T); i++)
+        out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (i * 8)));
+}
+
+template <typename T>
+static T GetInteger(const uint8_t* data)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); i++)
+        value |= static_cast<uint64_t>(data[i]) << (i * 8);
+    return static_cast<T>(value);
+}
+
+static void PutVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool GetVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7)
+    {
+        uint8_t byte = *data++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* FNV-1a */
+uint64_t HashProgram(const uint8_t* data, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+uint32_t GetDisplayChecksum(const Core& core)
+{
+    uint32_t hash = 2166136261u;
+    for (uint8_t byte : core.GetDisplayBitmap())
+        hash = (hash ^ byte) * 16777619u;
+    return hash;
+}
+
+/**
+ * Write a movie to a file
+ * @param path  File to write
+ * @param movie Movie, with its events sorted by cycle
+ * @return True on success, false otherwise
+ */
+bool SaveMovie(const std::filesystem::path& path, const Movie& movie)
+{
+    std::vector<uint8_t> data(HeaderSize);
+    std::vector<uint8_t> index;
+    uint32_t chunkCount = 0;
+
+    for (size_t first = 0; first < movie.events.size(); first += ChunkEvents)
+    {
+        size_t last = std::min(first + ChunkEvents, movie.events.size());
+        uint64_t cycle = movie.events[first].cycle;
+
+        PutInteger<uint64_t>(index, cycle);
+        PutInteger<uint32_t>(index, static_cast<uint32_t>(data.size()));
+        PutInteger<uint32_t>(index, static_cast<uint32_t>(last - first));
+        chunkCount++;
+
+        for (size_t i = first; i < last; i++)
+        {
+            const MovieEvent& event = movie.events[i];
+
+            PutVarint(data, ((event.cycle - cycle) << 2) | static_cast<uint8_t>(event.kind));
+            if (event.kind == MovieEvent::Kind::KeyDown || event.kind == MovieEvent::Kind::KeyUp)
+                data.push_back(event.key);
+            else if (event.kind == MovieEvent::Kind::Checksum)
+                PutInteger<uint32_t>(data, event.checksum);
+            cycle = event.cycle;
+        }
+    }
+
+    std::vector<uint8_t> header;
+    header.insert(header.end(), std::begin(s_Magic), std::end(s_Magic));
+    PutInteger<uint16_t>(header, MovieVersion);
+    PutInteger<uint16_t>(header, 0);
+    PutInteger<uint64_t>(header, movie.romHash);
+    PutInteger<uint32_t>(header, movie.seed);
+    PutInteger<uint32_t>(header, chunkCount);
+    PutInteger<uint64_t>(header, movie.length);
+    PutInteger<uint64_t>(header, data.size());
+    std::copy(header.begin(), header.end(), data.begin());
+    data.insert(data.end(), index.begin(), index.end());
+
+    std::ofstream output(path, std::ios::binary | std::ios::out);
+    output.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!output)
+    {
+        printf("ERROR: failed to write '%s'\n", path.string().c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read a movie from a file
+ * @param path  File to read
+ * @param movie Receives the movie
+ * @return True on success, false if the file could not be read or is not a valid movie
+ */
+bool LoadMovie(const std::filesystem::path& path, Movie& movie)
+{
+    std::ifstream input(path, std::ios::binary | std::ios::in);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    if (!input.is_open())
+    {
+        printf("ERROR: failed to read '%s'\n", path.string().c_str());
+        return false;
+    }
+
+    if (data.size() < HeaderSize || !std::equal(std::begin(s_Magic), std::end(s_Magic), data.begin())
+        || GetInteger<uint16_t>(&data[4]) != MovieVersion)
+    {
+        printf("ERROR: '%s' is not a movie for this version of the emulator\n", path.string().c_str());
+        return false;
+    }
+
+    uint32_t chunkCount = GetInteger<uint32_t>(&data[20]);
+    uint64_t indexOffset = GetInteger<uint64_t>(&data[32]);
+
+    movie.romHash = GetInteger<uint64_t>(&data[8]);
+    movie.seed = GetInteger<uint32_t>(&data[16]);
+    movie.length = GetInteger<uint64_t>(&data[24]);
+    movie.events.clear();
+
+    if (indexOffset < HeaderSize || indexOffset > data.size()
+        || (data.size() - indexOffset) / IndexEntrySize < chunkCount)
+    {
+        printf("ERROR: '%s' is truncated\n", path.string().c_str());
+        return false;
+    }
+
+    for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+    {
+        const uint8_t* entry = &data[indexOffset + chunk * IndexEntrySize];
+        uint64_t cycle = GetInteger<uint64_t>(entry);
+        uint32_t offset = GetInteger<uint32_t>(entry + 8);
+        uint32_t count = GetInteger<uint32_t>(entry + 12);
+        const uint8_t* end = data.data() + indexOffset;
+        const uint8_t* p = data.data() + std::min<uint64_t>(offset, indexOffset);
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            MovieEvent event{ };
+            uint64_t code;
+
+            if (!GetVarint(p, end, code))
+            {
+                printf("ERROR: '%s' is corrupt\n", path.string().c_str());
+                return false;
+            }
+
+            cycle += code >> 2;
+            event.cycle = cycle;
+            event.kind = static_cast<MovieEvent::Kind>(code & 3);
+            if (event.kind == MovieEvent::Kind::KeyDown || event.kind == MovieEvent::Kind::KeyUp)
+            {
+                if (p == end)
+                {
+                    printf("ERROR: '%s' is corrupt\n", path.string().c_str());
+                    return false;
+                }
+                event.key = *p++ & 0xF;
+            }
+            else if (event.kind == MovieEvent::Kind::Checksum)
+            {
+                if (end - p < 4)
+                {
+                    printf("ERROR: '%s' is corrupt\n", path.string().c_str());
+                    return false;
+                }
+                event.checksum = GetInteger<uint32_t>(p);
+                p += 4;
+            }
+            movie.events.push_back(event);
+        }
+    }
+    return true;
+}
+
+MovieRecorder::MovieRecorder(const std::vector<uint8_t>& program, uint32_t seed)
+    : m_Ticks(0)
+{
+    m_Movie.romHash = HashProgram(program.data(), program.size());
+    m_Movie.seed = seed;
+}
+
+/**
+ * Record a key event
+ * @param cycle Cycle the core applies the event at, as returned by Core::QueueKey
+ * @param key   Key, 0 to 15
+ * @param down  True if the key was pressed, false if it was released
+ */
+void MovieRecorder::RecordKey(uint64_t cycle, uint8_t key, bool down)
+{
+    Insert({ cycle, down ? MovieEvent::Kind::KeyDown : MovieEvent::Kind::KeyUp, key });
+}
+
+/**
+ * Record a call to Core::TickTimers, made right after it
+ * @param core Core whose timers ticked
+ */
+void MovieRecorder::RecordTimerTick(const Core& core)
+{
+    Insert({ core.GetCycles(), MovieEvent::Kind::TimerTick });
+    if (++m_Ticks % ChecksumInterval == 0)
+        Insert({ core.GetCycles(), MovieEvent::Kind::Checksum, 0, GetDisplayChecksum(core) });
+}
+
+/**
+ * End the recording and write it to a file. Key events queued for cycles
+ * the core never reached are dropped.
+ * @param path File to write
+ * @param core Core the movie was recorded from
+ * @return True on success, false otherwise
+ */
+bool MovieRecorder::Save(const std::filesystem::path& path, const Core& core)
+{
+    m_Movie.length = core.GetCycles();
+    while (!m_Movie.events.empty() && m_Movie.events.back().cycle > m_Movie.length)
+        m_Movie.events.pop_back();
+    return SaveMovie(path, m_Movie);
+}
+
+/* Events on the same cycle keep the order they were recorded in */
+void MovieRecorder::Insert(const MovieEvent& event)
+{
+    auto position = std::upper_bound(m_Movie.events.begin(), m_Movie.events.end(), event.cycle,
+        [](uint64_t cycle, const MovieEvent& other) { return cycle < other.cycle; });
+    m_Movie.events.insert(position, event);
+}
+
+MoviePlayer::MoviePlayer(Movie movie)
+    : m_Movie(std::move(movie)), m_Next(0), m_Desyncs(0)
+{
+
+}
+
+bool MoviePlayer::Matches(const std::vector<uint8_t>& program) const
+{
+    return HashProgram(program.data(), program.size()) == m_Movie.romHash;
+}
+
+/**
+ * Run a core along the movie, applying every event on the cycle it was
+ * recorded on. The core must have been loaded with the program and seeded
+ * with GetSeed before the first call.
+ * @param core   Core to run
+ * @param cycles Maximum number of cycles to run
+ * @return Number of cycles run, less than cycles if the movie ended
+ */
+int MoviePlayer::Run(Core& core, int cycles)
+{
+    int executed = 0;
+
+    while (executed < cycles && !IsFinished(core))
+    {
+        for (; m_Next < m_Movie.events.size() && m_Movie.events[m_Next].cycle <= core.GetCycles(); m_Next++)
+        {
+            const MovieEvent& event = m_Movie.events[m_Next];
+
+            switch (event.kind)
+            {
+            case MovieEvent::Kind::TimerTick:
+                core.TickTimers();
+                break;
+            case MovieEvent::Kind::KeyDown:
+            case MovieEvent::Kind::KeyUp:
+                core.QueueKey(event.cycle, event.key, event.kind == MovieEvent::Kind::KeyDown);
+                break;
+            case MovieEvent::Kind::Checksum:
+                if (GetDisplayChecksum(core) != event.checksum && m_Desyncs++ == 0)
+                    printf("WARNING: replay went out of sync at cycle %llu\n", static_cast<unsigned long long>(event.cycle));
+                break;
+            }
+        }
+
+        uint64_t stop = (m_Next < m_Movie.events.size()) ? m_Movie.events[m_Next].cycle : m_Movie.length;
+        int budget = static_cast<int>(std::min<uint64_t>(cycles - executed, stop - std::min(stop, core.GetCycles())));
+
+        if (budget == 0)
+            break;
+        executed += core.RunCycles(budget);
+    }
+    return executed;
+}
+
+bool MoviePlayer::IsFinished(const Core& core) const
+{
+    return m_Next == m_Movie.events.size() && core.GetCycles() >= m_Movie.length;
+}
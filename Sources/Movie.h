@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+class Core;
+
+/* Something the host did to a core, at the cycle it happened on */
+struct MovieEvent
+{
+    enum class Kind : uint8_t
+    {
+        TimerTick,
+        KeyDown,
+        KeyUp,
+        Checksum,   // Display checksum, to find where a replay went out of sync
+    };
+
+    uint64_t cycle;
+    Kind     kind;
+    uint8_t  key;
+    uint32_t checksum;
+};
+
+/**
+ * Recording of a session: everything a core needs from outside to run it
+ * again exactly. The program is loaded at 0x200 and the core seeded with
+ * the recorded seed before the first cycle.
+ */
+struct Movie
+{
+    uint64_t romHash = 0;
+    uint32_t seed = 1;
+    uint64_t length = 0;    // Cycles the session ran for
+    std::vector<MovieEvent> events;
+};
+
+uint64_t HashProgram(const uint8_t* data, size_t length);
+uint32_t GetDisplayChecksum(const Core& core);
+
+bool SaveMovie(const std::filesystem::path& path, const Movie& movie);
+bool LoadMovie(const std::filesystem::path& path, Movie& movie);
+
+/**
+ * Builds a movie from the events of a running core. Key events can be
+ * queued for a later cycle than timer ticks recorded after them, so events
+ * are kept sorted by cycle as they arrive.
+ */
+class MovieRecorder
+{
+public:
+    /* A display checksum is recorded once a second */
+    constexpr static int ChecksumInterval = 60;
+
+    MovieRecorder(const std::vector<uint8_t>& program, uint32_t seed);
+
+    void RecordKey(uint64_t cycle, uint8_t key, bool down);
+    void RecordTimerTick(const Core& core);
+
+    bool Save(const std::filesystem::path& path, const Core& core);
+private:
+    Movie    m_Movie;
+    uint32_t m_Ticks;
+
+    void Insert(const MovieEvent& event);
+};
+
+/**
+ * Replays a movie into a core, with no dependency on the wall clock
+ */
+class MoviePlayer
+{
+public:
+    MoviePlayer(Movie movie);
+
+    bool Matches(const std::vector<uint8_t>& program) const;
+    uint32_t GetSeed() const { return m_Movie.seed; }
+    uint64_t GetLength() const { return m_Movie.length; }
+
+    int Run(Core& core, int cycles);
+
+    bool IsFinished(const Core& core) const;
+    int GetDesyncCount() const { return m_Desyncs; }
+private:
+    Movie  m_Movie;
+    size_t m_Next;
+    int    m_Desyncs;
+};
@@ -0,0 +1,225 @@
+#include <cstdio>
+#include <cstdlib>
+#include "NativeProgram.h"
+#include "Core.h"
+#include "Instruction.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+NativeProgram::NativeProgram()
+    : m_Library(nullptr), m_Module(nullptr), m_Core(nullptr), m_MemoryGeneration(0), m_Checked(false)
+{
+
+}
+
+NativeProgram::~NativeProgram()
+{
+    Close();
+}
+
+/**
+ * Load a library built by RecompileProgram
+ * @param path Path of the library
+ * @return True on success, false otherwise
+ */
+bool NativeProgram::Open(const std::filesystem::path& path)
+{
+    Close();
+
+#ifdef _WIN32
+    HMODULE library = LoadLibraryW(path.c_str());
+    if (library == nullptr)
+    {
+        printf("ERROR: failed to load '%s'\n", path.string().c_str());
+        return false;
+    }
+    m_Library = library;
+    m_Module = reinterpret_cast<const NativeModule*>(GetProcAddress(library, "Chip8NativeModule"));
+#else
+    m_Library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (m_Library == nullptr)
+    {
+        printf("ERROR: failed to load '%s': %s\n", path.string().c_str(), dlerror());
+        return false;
+    }
+    m_Module = static_cast<const NativeModule*>(dlsym(m_Library, "Chip8NativeModule"));
+#endif
+
+    if (m_Module == nullptr || m_Module->abiVersion != NativeAbiVersion)
+    {
+        printf("ERROR: '%s' is not a recompiled program for this version of the emulator\n", path.string().c_str());
+        Close();
+        return false;
+    }
+
+    m_BlockAt.assign(Core::MemorySize, -1);
+    m_Stale.assign(m_Module->blockCount, true);
+    m_CodeLines.assign(Core::MemoryLines, false);
+    m_PageBlocks.assign(Core::MemoryPages, { });
+    m_PageGenerations.assign(Core::MemoryPages, 0);
+    m_Checked = false;
+
+    for (uint32_t index = 0; index < m_Module->blockCount; index++)
+    {
+        const NativeBlock& block = m_Module->blocks[index];
+        if (block.end > Core::MemorySize)
+            continue;
+
+        m_BlockAt[block.start] = static_cast<int>(index);
+        for (int line = block.start / Core::MemoryLineSize; line <= (block.end - 1) / Core::MemoryLineSize; line++)
+            m_CodeLines[line] = true;
+        for (int page = block.start / Core::MemoryPageSize; page <= (block.end - 1) / Core::MemoryPageSize; page++)
+            m_PageBlocks[page].push_back(static_cast<int>(index));
+    }
+
+    return true;
+}
+
+void NativeProgram::Close()
+{
+    if (m_Library != nullptr)
+    {
+#ifdef _WIN32
+        FreeLibrary(static_cast<HMODULE>(m_Library));
+#else
+        dlclose(m_Library);
+#endif
+    }
+
+    m_Library = nullptr;
+    m_Module = nullptr;
+    m_BlockAt.clear();
+    m_Stale.clear();
+    m_CodeLines.clear();
+    m_PageBlocks.clear();
+    m_PageGenerations.clear();
+}
+
+/**
+ * Compare every block on a page that was written since the last check
+ * against the image the library was built from. A block that was changed
+ * runs in the interpreter until its original bytes are restored.
+ */
+void NativeProgram::CheckWrittenPages()
+{
+    for (int page = 0; page < Core::MemoryPages; page++)
+    {
+        uint32_t generation = m_Core->GetPageGeneration(page);
+        if (m_Checked && generation == m_PageGenerations[page])
+            continue;
+
+        for (int index : m_PageBlocks[page])
+        {
+            const NativeBlock& block = m_Module->blocks[index];
+            const uint8_t* original = m_Module->image + (block.start - m_Module->origin);
+
+            m_Stale[index] = !std::equal(original, original + (block.end - block.start), m_Core->m_Memory.begin() + block.start);
+        }
+        m_PageGenerations[page] = generation;
+    }
+
+    m_MemoryGeneration = m_Core->GetMemoryGeneration();
+    m_Checked = true;
+}
+
+/**
+ * Run a core for a number of cycles, using native code wherever it is valid
+ * @param core   Core to run, which should hold the program at the library's origin
+ * @param cycles Number of cycles to run
+ * @return Number of cycles run, see Core::RunCycles
+ */
+int NativeProgram::Run(Core& core, int cycles)
+{
+    NativeContext context = {
+        core.m_Registers.v, &core.m_Registers.i, &core.m_Registers.ip,
+        &core.m_Registers.sp, core.m_Registers.stack,
+        &core.m_Registers.dt, &core.m_Registers.st,
+        core.m_Memory.data(), &core.m_KeyStates, this,
+        Clear, Draw, Write, Random, WaitKey, Audio
+    };
+    int executed = 0;
+
+    m_Core = &core;
+    while (executed < cycles)
+    {
+        core.ApplyInput();
+
+        /* Blocks may not run past the next key event, so it lands on its exact cycle */
+        uint64_t untilInput = core.GetNextInputCycle() - core.m_Cycles;
+        int budget = static_cast<int>(std::min<uint64_t>(cycles - executed, untilInput));
+
+        if (core.WaitingForKey())
+        {
+            core.m_Cycles += budget;
+            executed += budget;
+            continue;
+        }
+
+        if (!m_Checked || core.GetMemoryGeneration() != m_MemoryGeneration)
+            CheckWrittenPages();
+
+        uint16_t ip = core.GetIP();
+        int index = (ip < Core::MemorySize) ? m_BlockAt[ip] : -1;
+        int count = (index != -1 && !m_Stale[index]) ? m_Module->step(&context, budget) : 0;
+
+        if (count == 0)
+        {
+            core.DoCycle();
+            count = 1;
+        }
+        else
+        {
+            core.m_Cycles += count;
+        }
+        executed += count;
+    }
+    m_Core = nullptr;
+
+    return executed;
+}
+
+/* Callbacks for the instructions that recompiled code leaves to the core */
+
+void NativeProgram::Clear(void* host)
+{
+    Core& core = *static_cast<NativeProgram*>(host)->m_Core;
+    std::fill_n(core.m_DisplayBitmap.begin(), core.m_DisplayBitmap.size(), 0);
+}
+
+uint8_t NativeProgram::Draw(void* host, int x, int y, int address, int length)
+{
+    return static_cast<NativeProgram*>(host)->m_Core->DrawSprite(x, y, address, length);
+}
+
+int NativeProgram::Write(void* host, int address, uint8_t value)
+{
+    NativeProgram& program = *static_cast<NativeProgram*>(host);
+    uint16_t wrapped = static_cast<uint16_t>(address) & Core::AddressMask;
+
+    program.m_Core->WriteByte(wrapped, value);
+    return program.m_CodeLines[wrapped / Core::MemoryLineSize];
+}
+
+uint8_t NativeProgram::Random(void* host)
+{
+    return static_cast<NativeProgram*>(host)->m_Core->NextRandom() % 255;
+}
+
+void NativeProgram::WaitKey(void* host, int dst)
+{
+    Core& core = *static_cast<NativeProgram*>(host)->m_Core;
+    core.m_KeyDst = static_cast<uint8_t>(dst);
+    core.m_WaitingForKey = true;
+}
+
+void NativeProgram::Audio(void* host, int instruction, int offset)
+{
+    Core& core = *static_cast<NativeProgram*>(host)->m_Core;
+    core.ExecuteAudio(Instruction(static_cast<uint16_t>(instruction)), core.m_Cycles + offset);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+class Core;
+
+/*
+ * Everything recompiled code can touch. The recompiler writes a copy of these
+ * declarations into every generated source, so any change to their layout,
+ * or to how the core behaves underneath them, must bump NativeAbiVersion.
+ */
+constexpr int NativeAbiVersion = 3;
+
+struct NativeContext
+{
+    uint8_t*        v;
+    uint16_t*       i;
+    uint16_t*       ip;
+    uint8_t*        sp;
+    uint16_t*       stack;
+    uint8_t*        dt;
+    uint8_t*        st;
+    const uint8_t*  memory;
+    const uint32_t* keys;
+    void*           host;
+    void    (*clear)(void* host);
+    uint8_t (*draw)(void* host, int x, int y, int address, int length);
+    int     (*write)(void* host, int address, uint8_t value); // Nonzero if the byte was recompiled code
+    uint8_t (*random)(void* host);
+    void    (*waitKey)(void* host, int dst);
+    void    (*audio)(void* host, int instruction, int offset); // Offset is the cycle within the running block
+};
+
+struct NativeBlock
+{
+    uint16_t start;
+    uint16_t end;       // One past the last byte of the block
+    uint16_t length;    // Number of instructions
+};
+
+/* Exported by a recompiled library as Chip8NativeModule */
+struct NativeModule
+{
+    int                abiVersion;
+    int                origin;
+    const uint8_t*     image;       // Program the library was generated from
+    uint32_t           imageSize;
+    const NativeBlock* blocks;
+    uint32_t           blockCount;
+
+    /* Run the block at *ip if it has at most budget instructions, returns how many ran or 0 */
+    int (*step)(NativeContext* context, int budget);
+};
+
+/**
+ * A program recompiled ahead of time into a shared library. It runs against
+ * the state of an ordinary Core, and every instruction that has no native
+ * code, or whose bytes were overwritten since the library was built, runs
+ * in the interpreter instead.
+ */
+class NativeProgram
+{
+public:
+    NativeProgram();
+    NativeProgram(const NativeProgram&) = delete;
+    ~NativeProgram();
+
+    NativeProgram& operator=(const NativeProgram&) = delete;
+
+    bool Open(const std::filesystem::path& path);
+    void Close();
+
+    bool IsOpen() const { return m_Module != nullptr; }
+    int GetOrigin() const { return m_Module->origin; }
+    std::vector<uint8_t> GetImage() const { return { m_Module->image, m_Module->image + m_Module->imageSize }; }
+
+    int Run(Core& core, int cycles);
+private:
+    void*               m_Library;
+    const NativeModule* m_Module;
+    Core*               m_Core;
+    std::vector<int>    m_BlockAt;      // Index of the block starting at each address, or -1
+    std::vector<bool>   m_Stale;        // Blocks whose bytes no longer match the image
+    std::vector<bool>   m_CodeLines;    // Memory lines that hold part of a block
+    std::vector<std::vector<int>> m_PageBlocks;     // Blocks overlapping each memory page
+    std::vector<uint32_t> m_PageGenerations;        // Generation of each page when its blocks were checked
+    uint32_t            m_MemoryGeneration;
+    bool                m_Checked;
+
+    void CheckWrittenPages();
+
+    static void Clear(void* host);
+    static uint8_t Draw(void* host, int x, int y, int address, int length);
+    static int Write(void* host, int address, uint8_t value);
+    static uint8_t Random(void* host);
+    static void WaitKey(void* host, int dst);
+    static void Audio(void* host, int instruction, int offset);
+};
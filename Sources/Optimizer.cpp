@@ -0,0 +1,291 @@
+#include <cstdio>
+#include "Optimizer.h"
+#include "Assembler.h"
+#include "Instruction.h"
+
+static constexpr uint16_t Opcode_RET = 0x00EE;
+
+static bool IsSkip(Instruction::Type type)
+{
+    return type == Instruction::Type::SE || type == Instruction::Type::SNE
+        || type == Instruction::Type::SKP || type == Instruction::Type::SKNP;
+}
+
+static bool HasAddress(Instruction::Type type)
+{
+    return type == Instruction::Type::JP || type == Instruction::Type::CALL
+        || type == Instruction::Type::LD_I_IMM || type == Instruction::Type::JP_V0_IMM;
+}
+
+/**
+ * Program being optimized, as a list of instruction words
+ */
+class Program
+{
+public:
+    Program(const std::vector<uint8_t>& bytes, int origin)
+        : m_Origin(origin), m_Words(bytes.size() / 2)
+    {
+        for (size_t i = 0; i < m_Words.size(); i++)
+            m_Words[i] = (bytes[i * 2] << 8) | bytes[i * 2 + 1];
+    }
+
+    size_t GetCount() const { return m_Words.size(); }
+    uint16_t GetWord(size_t index) const { return m_Words[index]; }
+    void SetWord(size_t index, uint16_t word) { m_Words[index] = word; }
+    Instruction Decode(size_t index) const { return Instruction(m_Words[index]); }
+
+    /* Index of the instruction at an address, or -1 if the address is not the start of one */
+    int IndexOf(int address) const
+    {
+        int offset = address - m_Origin;
+        if (offset < 0 || (offset & 1) != 0 || offset / 2 >= static_cast<int>(m_Words.size()))
+            return -1;
+        return offset / 2;
+    }
+
+    bool Contains(int address) const
+    {
+        return address >= m_Origin && address < m_Origin + static_cast<int>(m_Words.size()) * 2;
+    }
+private:
+    int                   m_Origin;
+    std::vector<uint16_t> m_Words;
+};
+
+/**
+ * Retarget jumps and calls that land on a JP to the end of the chain, and
+ * replace a JP to a RET with the RET itself
+ */
+static void ThreadJumps(Program& program, std::vector<bool>& relocatable, OptimizerReport& report)
+{
+    for (size_t i = 0; i < program.GetCount(); i++)
+    {
+        Instruction ins = program.Decode(i);
+        if (ins.type != Instruction::Type::JP && ins.type != Instruction::Type::CALL)
+            continue;
+
+        int target = ins.GetAddress();
+        int last = -1;
+        int hops = 0;
+
+        /* Bounded by the program size so a cycle of jumps cannot hang the loop */
+        for (int index = program.IndexOf(target); index != -1 && hops < static_cast<int>(program.GetCount()); index = program.IndexOf(target))
+        {
+            Instruction next = program.Decode(index);
+            if (next.type != Instruction::Type::JP || next.GetAddress() == target)
+                break;
+            target = next.GetAddress();
+            last = index;
+            ++hops;
+        }
+
+        if (hops > 0)
+        {
+            program.SetWord(i, (ins.instruction & 0xF000) | target);
+            relocatable[i] = relocatable[last];
+            report.threadedJumps++;
+            report.cyclesSaved += hops;
+        }
+
+        int index = program.IndexOf(target);
+        if (ins.type == Instruction::Type::JP && index != -1 && program.GetWord(index) == Opcode_RET)
+        {
+            program.SetWord(i, Opcode_RET);
+            report.inlinedReturns++;
+            report.cyclesSaved++;
+        }
+    }
+}
+
+/**
+ * Find why instructions cannot be removed without breaking the program
+ * @return A description of the problem, or nullptr if removal is safe
+ */
+static const char* FindRemovalHazard(const Program& program, const std::vector<bool>& relocatable, const AssemblerState& state)
+{
+    if (state.layoutDependentData)
+        return "a byte or nibble operand is computed from label addresses";
+
+    for (size_t i = 0; i < program.GetCount(); i++)
+    {
+        Instruction ins = program.Decode(i);
+
+        if (ins.type == Instruction::Type::JP_V0_IMM)
+            return "the program uses JP V0, addr";
+        if (HasAddress(ins.type) && !relocatable[i] && program.Contains(ins.GetAddress()))
+            return "a numeric address points into the program";
+        if (HasAddress(ins.type) && program.Contains(ins.GetAddress()) && program.IndexOf(ins.GetAddress()) == -1)
+            return "an address points between instructions";
+    }
+    return nullptr;
+}
+
+/**
+ * Mark no-op moves, redundant loads of I and unreachable code for removal.
+ * Instructions that are branch targets or that follow a skip are never removed,
+ * so control flow is unchanged.
+ */
+static void FindRemovable(const Program& program, const AssemblerState& state, std::vector<bool>& removed, OptimizerReport& report)
+{
+    std::vector<bool> entry(program.GetCount(), false);
+
+    if (program.GetCount() > 0)
+        entry[0] = true;
+    for (int id = 0; id < static_cast<int>(state.symbols.GetCount()); id++)
+    {
+        int index = state.symbols.IsDefined(id) ? program.IndexOf(state.symbols.GetValue(id)) : -1;
+        if (index != -1)
+            entry[index] = true;
+    }
+    for (size_t i = 0; i < program.GetCount(); i++)
+    {
+        Instruction ins = program.Decode(i);
+        int index = HasAddress(ins.type) ? program.IndexOf(ins.GetAddress()) : -1;
+        if (index != -1)
+            entry[index] = true;
+    }
+
+    int  knownI = -1;
+    bool afterSkip = false;
+    bool unreachable = false;
+
+    for (size_t i = 0; i < program.GetCount(); i++)
+    {
+        Instruction ins = program.Decode(i);
+        bool removable = !entry[i] && !afterSkip;
+
+        if (entry[i])
+        {
+            knownI = -1;
+            unreachable = false;
+        }
+
+        if (unreachable)
+        {
+            removed[i] = true;
+            report.removedDead++;
+            afterSkip = false;
+            continue;
+        }
+
+        switch (ins.type)
+        {
+        case Instruction::Type::LD:
+            if (ins.encoding == Instruction::Encoding::DestinationSource && ins.GetDst() == ins.GetSrc() && removable)
+            {
+                removed[i] = true;
+                report.removedMoves++;
+                report.cyclesSaved++;
+            }
+            break;
+        case Instruction::Type::LD_I_IMM:
+            if (knownI == ins.GetAddress() && removable)
+            {
+                removed[i] = true;
+                report.removedLoads++;
+                report.cyclesSaved++;
+            }
+            else
+            {
+                knownI = (afterSkip && knownI != ins.GetAddress()) ? -1 : ins.GetAddress();
+            }
+            break;
+        case Instruction::Type::JP:
+        case Instruction::Type::RET:
+            unreachable = !afterSkip;
+            knownI = -1;
+            break;
+        case Instruction::Type::CALL:
+        case Instruction::Type::JP_V0_IMM:
+        case Instruction::Type::ADD_I_V:
+        case Instruction::Type::LD_F_V:
+        case Instruction::Type::UNKNOWN:
+            knownI = -1;
+            break;
+        }
+
+        afterSkip = !removed[i] && IsSkip(ins.type);
+    }
+}
+
+/**
+ * Run peephole optimizations over an assembled program: jump threading,
+ * removal of LD Vx, Vx, of LD I that reloads the address I already holds,
+ * and of unreachable code after JP and RET. Addresses that came from labels
+ * are moved along with the code. The program is assumed not to modify its
+ * own instructions.
+ * @param program Assembled program, rewritten in place
+ * @param state   Assembler state, whose symbols are moved along with the code
+ * @param report  Receives what was changed
+ * @return True if the program changed, false otherwise
+ */
+bool OptimizeProgram(std::vector<uint8_t>& program, AssemblerState& state, OptimizerReport& report)
+{
+    Program code(program, state.origin);
+    std::vector<bool> relocatable(code.GetCount(), true);
+    std::vector<bool> removed(code.GetCount(), false);
+
+    report = { };
+    report.sizeBefore = program.size();
+
+    for (int address : state.literalAddresses)
+    {
+        int index = code.IndexOf(address);
+        if (index != -1)
+            relocatable[index] = false;
+    }
+
+    ThreadJumps(code, relocatable, report);
+
+    report.blocked = FindRemovalHazard(code, relocatable, state);
+    if (report.blocked == nullptr)
+        FindRemovable(code, state, removed, report);
+
+    /* Removed instructions before each index, so old addresses map to new ones */
+    std::vector<int> shift(code.GetCount() + 1, 0);
+    for (size_t i = 0; i < code.GetCount(); i++)
+        shift[i + 1] = shift[i] + (removed[i] ? 1 : 0);
+
+    auto relocate = [&](int address) {
+        int index = code.IndexOf(address);
+        if (index == -1 && address == state.origin + static_cast<int>(code.GetCount()) * 2)
+            index = static_cast<int>(code.GetCount());
+        return (index == -1) ? address : address - shift[index] * 2;
+    };
+
+    program.clear();
+    for (size_t i = 0; i < code.GetCount(); i++)
+    {
+        if (removed[i])
+            continue;
+
+        uint16_t word = code.GetWord(i);
+        Instruction ins(word);
+        if (HasAddress(ins.type) && relocatable[i])
+            word = (word & 0xF000) | (relocate(ins.GetAddress()) & 0xFFF);
+
+        program.push_back(word >> 8);
+        program.push_back(word & 0xFF);
+    }
+
+    for (int id = 0; id < static_cast<int>(state.symbols.GetCount()); id++)
+    {
+        if (state.symbols.IsDefined(id))
+            state.symbols.SetValue(id, relocate(state.symbols.GetValue(id)));
+    }
+
+    report.sizeAfter = program.size();
+    return report.threadedJumps + report.inlinedReturns + shift.back() > 0;
+}
+
+void PrintOptimizerReport(const OptimizerReport& report)
+{
+    printf("Optimizer: %zu -> %zu bytes, %d cycles saved per pass over the rewritten code\n",
+        report.sizeBefore, report.sizeAfter, report.cyclesSaved);
+    printf("  %d jumps threaded, %d jumps to RET inlined\n", report.threadedJumps, report.inlinedReturns);
+    printf("  %d LD Vx, Vx removed, %d redundant LD I removed, %d unreachable instructions removed\n",
+        report.removedMoves, report.removedLoads, report.removedDead);
+    if (report.blocked != nullptr)
+        printf("  no instructions removed: %s\n", report.blocked);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct AssemblerState;
+
+struct OptimizerReport
+{
+    size_t      sizeBefore;
+    size_t      sizeAfter;
+    int         threadedJumps;  // JP or CALL retargeted past a chain of JPs
+    int         inlinedReturns; // JP to a RET replaced by the RET
+    int         removedMoves;   // LD Vx, Vx
+    int         removedLoads;   // LD I that reloads the address I already holds
+    int         removedDead;    // Unreachable instructions after JP or RET
+    int         cyclesSaved;    // Per pass over every rewritten instruction
+    const char* blocked;        // Why no instruction could be removed, or nullptr
+};
+
+bool OptimizeProgram(std::vector<uint8_t>& program, AssemblerState& state, OptimizerReport& report);
+void PrintOptimizerReport(const OptimizerReport& report);
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include "Recompiler.h"
+#include "CodeMap.h"
+#include "Disassembler.h"
+#include "NativeProgram.h"
+
+/* Must match the declarations in NativeProgram.h */
+static constexpr char s_Prelude[] = R"(#include <cstdint>
+
+#ifdef _WIN32
+#define CHIP8_EXPORT __declspec(dllexport)
+#else
+#define CHIP8_EXPORT __attribute__((visibility("default")))
+#endif
+
+struct NativeContext
+{
+    uint8_t*        v;
+    uint16_t*       i;
+    uint16_t*       ip;
+    uint8_t*        sp;
+    uint16_t*       stack;
+    uint8_t*        dt;
+    uint8_t*        st;
+    const uint8_t*  memory;
+    const uint32_t* keys;
+    void*           host;
+    void    (*clear)(void* host);
+    uint8_t (*draw)(void* host, int x, int y, int address, int length);
+    int     (*write)(void* host, int address, uint8_t value);
+    uint8_t (*random)(void* host);
+    void    (*waitKey)(void* host, int dst);
+    void    (*audio)(void* host, int instruction, int offset);
+};
+
+struct NativeBlock
+{
+    uint16_t start;
+    uint16_t end;
+    uint16_t length;
+};
+
+struct NativeModule
+{
+    int                abiVersion;
+    int                origin;
+    const uint8_t*     image;
+    uint32_t           imageSize;
+    const NativeBlock* blocks;
+    uint32_t           blockCount;
+    int (*step)(NativeContext* context, int budget);
+};
+
+static inline uint8_t ReadByte(const NativeContext* c, uint16_t address)
+{
+    return c->memory[address & 0xFFF];
+}
+)";
+
+template <typename ...Args>
+static void Emit(std::string& out, const char* fmt, Args... args)
+{
+    char buffer[256];
+    int length = snprintf(buffer, sizeof(buffer), fmt, args...);
+
+    if (length > 0)
+        out.append(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+}
+
+/**
+ * Write the C++ for one instruction. Every statement mirrors Core::DoCycle,
+ * including its quirks, so native and interpreted code can take turns.
+ * @param out     Source being generated
+ * @param ins     Instruction
+ * @param address Address of the instruction
+ * @param count   Instructions executed once this one has run
+ * @return True if the instruction returns from the block function
+ */
+static bool EmitInstruction(std::string& out, const Instruction& ins, int address, int count)
+{
+    const int next = address + 2;
+    const int x = ins.GetDst();
+    const int y = ins.GetSrc();
+
+    switch (ins.type)
+    {
+    case Instruction::Type::CLS:
+        Emit(out, "    c->clear(c->host);\n");
+        break;
+    case Instruction::Type::RET:
+        Emit(out, "    *c->ip = c->stack[--*c->sp];\n    return %d;\n", count);
+        return true;
+    case Instruction::Type::JP:
+        Emit(out, "    *c->ip = 0x%03X;\n    return %d;\n", ins.GetAddress(), count);
+        return true;
+    case Instruction::Type::JP_V0_IMM:
+        Emit(out, "    *c->ip = static_cast<uint16_t>(0x%03X + v[0]);\n    return %d;\n", ins.GetAddress(), count);
+        return true;
+    case Instruction::Type::CALL:
+        Emit(out, "    c->stack[(*c->sp)++] = 0x%03X;\n    *c->ip = 0x%03X;\n    return %d;\n", next, ins.GetAddress(), count);
+        return true;
+    case Instruction::Type::SE:
+    case Instruction::Type::SNE:
+    {
+        const char* compare = (ins.type == Instruction::Type::SE) ? "==" : "!=";
+        if (ins.encoding == Instruction::Encoding::DestinationByte)
+            Emit(out, "    *c->ip = (v[%d] %s 0x%02X) ? 0x%03X : 0x%03X;\n", x, compare, ins.GetByte(), next + 2, next);
+        else
+            Emit(out, "    *c->ip = (v[%d] %s v[%d]) ? 0x%03X : 0x%03X;\n", x, compare, y, next + 2, next);
+        Emit(out, "    return %d;\n", count);
+        return true;
+    }
+    case Instruction::Type::SKP:
+        Emit(out, "    *c->ip = (*c->keys & (1 << v[%d])) ? 0x%03X : 0x%03X;\n    return %d;\n", x, next + 2, next, count);
+        return true;
+    case Instruction::Type::SKNP:
+        Emit(out, "    *c->ip = (*c->keys & (1 << v[%d])) == 0 ? 0x%03X : 0x%03X;\n    return %d;\n", x, next + 2, next, count);
+        return true;
+    case Instruction::Type::LD:
+        if (ins.encoding == Instruction::Encoding::DestinationByte)
+            Emit(out, "    v[%d] = 0x%02X;\n", x, ins.GetByte());
+        else
+            Emit(out, "    v[%d] = v[%d];\n", x, y);
+        break;
+    case Instruction::Type::ADD:
+        if (ins.encoding == Instruction::Encoding::DestinationByte)
+            Emit(out, "    v[%d] += 0x%02X;\n", x, ins.GetByte());
+        else
+            Emit(out, "    t = v[%d] + v[%d];\n    v[15] = t > 255;\n    v[%d] = t & 0xFF;\n", x, y, x);
+        break;
+    case Instruction::Type::OR:
+        Emit(out, "    v[%d] |= v[%d];\n", x, y);
+        break;
+    case Instruction::Type::AND:
+        Emit(out, "    v[%d] &= v[%d];\n", x, y);
+        break;
+    case Instruction::Type::XOR:
+        Emit(out, "    v[%d] ^= v[%d];\n", x, y);
+        break;
+    case Instruction::Type::SUB:
+        Emit(out, "    v[15] = v[%d] > v[%d];\n    v[%d] = v[%d] - v[%d];\n", x, y, x, x, y);
+        break;
+    case Instruction::Type::SHR:
+        Emit(out, "    v[15] = v[%d] & 0x1;\n    v[%d] >>= 2;\n", x, x);
+        break;
+    case Instruction::Type::SUBN:
+        Emit(out, "    v[15] = v[%d] > v[%d];\n    v[%d] = v[%d] - v[%d];\n", y, x, x, y, x);
+        break;
+    case Instruction::Type::SHL:
+        Emit(out, "    v[15] = !!(v[%d] & 0x80);\n    v[%d] <<= 2;\n", x, x);
+        break;
+    case Instruction::Type::RND:
+        Emit(out, "    v[%d] = c->random(c->host) & 0x%02X;\n", x, ins.GetByte());
+        break;
+    case Instruction::Type::DRW:
+        Emit(out, "    v[15] = c->draw(c->host, v[%d], v[%d], *c->i, %d);\n", x, y, ins.GetByte() & 0x0F);
+        break;
+    case Instruction::Type::LD_F_V:
+        Emit(out, "    *c->i = (v[%d] & 0xF) * 5;\n", x);
+        break;
+    case Instruction::Type::LD_I_IMM:
+        Emit(out, "    *c->i = 0x%03X;\n", ins.GetAddress());
+        break;
+    case Instruction::Type::LD_V0V_I:
+        Emit(out, "    for (int n = 0; n <= %d; n++)\n        v[n] = ReadByte(c, static_cast<uint16_t>(*c->i + n));\n", x);
+        break;
+    case Instruction::Type::LD_V_DT:
+        Emit(out, "    v[%d] = *c->dt;\n", x);
+        break;
+    case Instruction::Type::LD_DT_V:
+        Emit(out, "    *c->dt = v[%d];\n", x);
+        break;
+    case Instruction::Type::LD_ST_V:
+    case Instruction::Type::LD_AUDIO_I:
+    case Instruction::Type::LD_PITCH_V:
+        Emit(out, "    c->audio(c->host, 0x%04X, %d);\n", ins.instruction, count - 1);
+        break;
+    case Instruction::Type::ADD_I_V:
+        Emit(out, "    *c->i += v[%d];\n", x);
+        break;
+    case Instruction::Type::LD_V_K:
+        /* The core stops executing until a key is pressed */
+        Emit(out, "    c->waitKey(c->host, %d);\n    *c->ip = 0x%03X;\n    return %d;\n", x, next, count);
+        return true;
+    case Instruction::Type::LD_B_V:
+    case Instruction::Type::LD_I_V0V:
+        /* Leave the block if the program wrote over recompiled code, which the host then re-checks */
+        if (ins.type == Instruction::Type::LD_B_V)
+            Emit(out, "    t = c->write(c->host, *c->i + 0, v[%d] / 100);\n"
+                      "    t |= c->write(c->host, *c->i + 1, (v[%d] / 10) %% 10);\n"
+                      "    t |= c->write(c->host, *c->i + 2, v[%d] %% 10);\n", x, x, x);
+        else
+            Emit(out, "    t = 0;\n    for (int n = 0; n <= %d; n++)\n        t |= c->write(c->host, *c->i + n, v[n]);\n", x);
+        Emit(out, "    if (t)\n    {\n        *c->ip = 0x%03X;\n        return %d;\n    }\n", next, count);
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+/**
+ * Translate a program into C++ with one function per basic block. The
+ * exported step function dispatches on the instruction pointer, which also
+ * covers the targets of RET and JP V0, addr, and runs one block at a time so
+ * the emulator keeps control of timing.
+ * @param sourceOut String to receive the source
+ * @param program   Program to translate
+ * @param length    Length of the program in bytes
+ * @param origin    Address the program is loaded at
+ * @return True on success, false if the program contains no reachable code
+ */
+bool GenerateNativeSource(std::string& sourceOut, const uint8_t* program, size_t length, int origin)
+{
+    CodeMap map(program, length, origin);
+    const auto& blocks = map.GetBlocks();
+    char text[MaxDisassemblyLineLength];
+
+    if (blocks.empty())
+    {
+        puts("ERROR: the program contains no reachable code");
+        return false;
+    }
+
+    sourceOut = s_Prelude;
+    sourceOut.reserve(sourceOut.size() + length * 96 + blocks.size() * 128);
+
+    Emit(sourceOut, "\nstatic const uint8_t s_Image[%zu] = {", length);
+    for (size_t i = 0; i < length; i++)
+        Emit(sourceOut, "%s0x%02X,", (i % 16 == 0) ? "\n    " : " ", program[i]);
+    sourceOut += "\n};\n";
+
+    for (const auto& [start, block] : blocks)
+    {
+        const int count = (block.end - block.start) / 2;
+        bool returned = false;
+
+        Emit(sourceOut, "\nstatic int Block_%03X(NativeContext* c)\n{\n    [[maybe_unused]] uint8_t* v = c->v;\n    [[maybe_unused]] int t = 0;\n\n", start);
+        for (int address = block.start, n = 1; address < block.end && !returned; address += 2, n++)
+        {
+            Instruction ins(static_cast<uint16_t>((program[address - origin] << 8) | program[address - origin + 1]));
+
+            text[FormatInstruction(text, ins)] = '\0';
+            Emit(sourceOut, "    // 0x%03X: %s\n", address, text);
+            returned = EmitInstruction(sourceOut, ins, address, n);
+        }
+
+        if (!returned)
+            Emit(sourceOut, "    *c->ip = 0x%03X;\n    return %d;\n", block.end, count);
+        sourceOut += "}\n";
+    }
+
+    sourceOut += "\nstatic const NativeBlock s_Blocks[] = {\n";
+    for (const auto& [start, block] : blocks)
+        Emit(sourceOut, "    { 0x%03X, 0x%03X, %d },\n", block.start, block.end, (block.end - block.start) / 2);
+    sourceOut += "};\n\nstatic int Step(NativeContext* c, int budget)\n{\n    switch (*c->ip)\n    {\n";
+    for (const auto& [start, block] : blocks)
+        Emit(sourceOut, "    case 0x%03X: return (budget >= %d) ? Block_%03X(c) : 0;\n", start, (block.end - block.start) / 2, start);
+    sourceOut += "    }\n    return 0;\n}\n";
+
+    Emit(sourceOut, "\nextern \"C\" CHIP8_EXPORT const NativeModule Chip8NativeModule = {\n"
+        "    %d, 0x%03X, s_Image, sizeof(s_Image), s_Blocks, %zu, Step\n};\n", NativeAbiVersion, origin, blocks.size());
+    return true;
+}
+
+/**
+ * Build a generated source into a shared library with the platform's C++
+ * compiler, or with the one named by the CHIP8_CXX environment variable
+ * @param source  Path of the generated source
+ * @param library Path of the library to create
+ * @return True on success, false otherwise
+ */
+bool CompileNativeSource(const std::filesystem::path& source, const std::filesystem::path& library)
+{
+    const char* compiler = getenv("CHIP8_CXX");
+    std::string command;
+
+#ifdef _WIN32
+    command = std::string((compiler != nullptr) ? compiler : "cl") + " /nologo /O2 /LD /EHsc \""
+        + source.string() + "\" /Fe\"" + library.string() + "\"";
+#else
+    command = std::string((compiler != nullptr) ? compiler : "c++") + " -O2 -shared -fPIC -o \""
+        + library.string() + "\" \"" + source.string() + "\"";
+#endif
+
+    if (std::system(command.c_str()) != 0)
+    {
+        printf("ERROR: '%s' failed\n", command.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Translate a program to C++ next to the library and compile it
+ * @param program Program to recompile
+ * @param origin  Address the program is loaded at
+ * @param library Path of the library to create, the source is written with a .cpp extension
+ * @return True on success, false otherwise
+ */
+bool RecompileProgram(const std::vector<uint8_t>& program, int origin, const std::filesystem::path& library)
+{
+    std::filesystem::path source = library;
+    std::string code;
+
+    if (!GenerateNativeSource(code, program.data(), program.size(), origin))
+        return false;
+
+    source.replace_extension(".cpp");
+    std::ofstream output(source, std::ios::binary | std::ios::out);
+    output.write(code.data(), code.size());
+    output.close();
+    if (!output)
+    {
+        printf("ERROR: failed to write '%s'\n", source.string().c_str());
+        return false;
+    }
+
+    return CompileNativeSource(source, library);
+}
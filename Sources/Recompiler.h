@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+bool GenerateNativeSource(std::string& sourceOut, const uint8_t* program, size_t length, int origin);
+bool CompileNativeSource(const std::filesystem::path& source, const std::filesystem::path& library);
+bool RecompileProgram(const std::vector<uint8_t>& program, int origin, const std::filesystem::path& library);
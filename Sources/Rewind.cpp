@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cstring>
+#include "Rewind.h"
+
+/*
+ * An entry is its length, the encoded delta and the length again, so the
+ * ring can be walked from either end. A delta is a list of runs, each a
+ * varint count of unchanged bytes to skip, a varint count of changed bytes
+ * and the XOR of those bytes.
+ */
+static constexpr size_t EntryOverhead = 2 * sizeof(uint32_t);
+
+/* Unchanged bytes shorter than this stay inside a run, which is smaller than starting a new one */
+static constexpr size_t MinimumGap = 4;
+
+static uint8_t* PutVarint(uint8_t* out, size_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+static bool GetVarint(const uint8_t*& data, const uint8_t* end, size_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7)
+    {
+        uint8_t byte = *data++;
+        value |= static_cast<size_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+static uint64_t Read64(const uint8_t* data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/**
+ * Encode the bytes that differ between two buffers
+ * @param a      First buffer
+ * @param b      Second buffer
+ * @param length Length of both buffers
+ * @param out    Receives the delta, which needs room for 3 * length bytes
+ * @return Length of the delta
+ */
+static size_t EncodeDelta(const uint8_t* a, const uint8_t* b, size_t length, uint8_t* out)
+{
+    uint8_t* p = out;
+    size_t position = 0;
+    size_t last = 0;
+
+    while (position < length)
+    {
+        while (position + 8 <= length && Read64(a + position) == Read64(b + position))
+            position += 8;
+        while (position < length && a[position] == b[position])
+            position++;
+        if (position == length)
+            break;
+
+        size_t start = position;
+        size_t end = position;
+        for (; position < length && position - end < MinimumGap; position++)
+        {
+            if (a[position] != b[position])
+                end = position + 1;
+        }
+
+        p = PutVarint(p, start - last);
+        p = PutVarint(p, end - start);
+        for (size_t i = start; i < end; i++)
+            *p++ = a[i] ^ b[i];
+        last = end;
+        position = end;
+    }
+    return p - out;
+}
+
+/* XOR a delta into a buffer, which turns either of the two encoded buffers into the other */
+static bool ApplyDelta(uint8_t* target, size_t length, const uint8_t* delta, size_t deltaLength)
+{
+    const uint8_t* end = delta + deltaLength;
+    size_t position = 0;
+
+    while (delta < end)
+    {
+        size_t skip, count;
+        if (!GetVarint(delta, end, skip) || !GetVarint(delta, end, count))
+            return false;
+        if (skip > length - position || count > length - position - skip || count > static_cast<size_t>(end - delta))
+            return false;
+
+        position += skip;
+        for (size_t i = 0; i < count; i++)
+            target[position++] ^= *delta++;
+    }
+    return true;
+}
+
+RewindBuffer::RewindBuffer(size_t capacity)
+    : m_Ring(capacity), m_Head(0), m_Tail(0), m_Used(0), m_Count(0),
+    m_Current{ }, m_Next{ }, m_HasCurrent(false), m_Delta(sizeof(CoreSnapshot) * 3)
+{
+
+}
+
+void RewindBuffer::Reset()
+{
+    m_Head = 0;
+    m_Tail = 0;
+    m_Used = 0;
+    m_Count = 0;
+    m_HasCurrent = false;
+}
+
+/**
+ * Add the state of a core as the newest frame. Call once per frame.
+ * @param core Core to capture
+ */
+void RewindBuffer::Capture(const Core& core)
+{
+    core.SaveState(m_Next);
+    if (m_HasCurrent)
+    {
+        size_t length = EncodeDelta(reinterpret_cast<const uint8_t*>(&m_Current),
+            reinterpret_cast<const uint8_t*>(&m_Next), sizeof(CoreSnapshot), m_Delta.data());
+        Push(m_Delta.data(), static_cast<uint32_t>(length));
+    }
+
+    memcpy(&m_Current, &m_Next, sizeof(CoreSnapshot));
+    m_HasCurrent = true;
+}
+
+/**
+ * Restore the core to the frame before the newest one and make that the
+ * newest frame
+ * @param core Core to restore
+ * @return True if the core went back a frame, false if the history is empty
+ */
+bool RewindBuffer::StepBack(Core& core)
+{
+    if (m_Count == 0)
+        return false;
+
+    uint32_t length;
+    size_t end = (m_Head + m_Ring.size() - sizeof(length)) % m_Ring.size();
+
+    Read(end, &length, sizeof(length));
+    size_t start = (end + m_Ring.size() - length - sizeof(length)) % m_Ring.size();
+
+    Read(start + sizeof(length), m_Delta.data(), length);
+    m_Head = start;
+    m_Used -= length + EntryOverhead;
+    m_Count--;
+
+    if (!ApplyDelta(reinterpret_cast<uint8_t*>(&m_Current), sizeof(CoreSnapshot), m_Delta.data(), length))
+    {
+        Reset();
+        return false;
+    }
+    return core.LoadState(m_Current);
+}
+
+void RewindBuffer::Write(size_t offset, const void* data, size_t length)
+{
+    offset %= m_Ring.size();
+    size_t first = std::min(length, m_Ring.size() - offset);
+
+    memcpy(m_Ring.data() + offset, data, first);
+    memcpy(m_Ring.data(), static_cast<const uint8_t*>(data) + first, length - first);
+}
+
+void RewindBuffer::Read(size_t offset, void* data, size_t length) const
+{
+    offset %= m_Ring.size();
+    size_t first = std::min(length, m_Ring.size() - offset);
+
+    memcpy(data, m_Ring.data() + offset, first);
+    memcpy(static_cast<uint8_t*>(data) + first, m_Ring.data(), length - first);
+}
+
+void RewindBuffer::Push(const uint8_t* data, uint32_t length)
+{
+    size_t needed = length + EntryOverhead;
+
+    /* The chain of deltas would have a gap, so the older history is useless */
+    if (needed > m_Ring.size())
+    {
+        Reset();
+        return;
+    }
+
+    while (m_Ring.size() - m_Used < needed)
+        DropOldest();
+
+    Write(m_Head, &length, sizeof(length));
+    Write(m_Head + sizeof(length), data, length);
+    Write(m_Head + sizeof(length) + length, &length, sizeof(length));
+    m_Head = (m_Head + needed) % m_Ring.size();
+    m_Used += needed;
+    m_Count++;
+}
+
+void RewindBuffer::DropOldest()
+{
+    uint32_t length;
+
+    Read(m_Tail, &length, sizeof(length));
+    m_Tail = (m_Tail + length + EntryOverhead) % m_Ring.size();
+    m_Used -= length + EntryOverhead;
+    m_Count--;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Core.h"
+
+/**
+ * History of core states for stepping back in time, one per frame. Each
+ * state is kept as the XOR of itself and the state after it, run-length
+ * encoded, in a fixed-size ring of bytes. Only the newest state is kept
+ * whole, and the oldest deltas are dropped when the ring is full.
+ */
+class RewindBuffer
+{
+public:
+    /* Holds well over 10 minutes of frames at 60Hz for most programs */
+    constexpr static size_t DefaultCapacity = 4 * 1024 * 1024;
+
+    RewindBuffer(size_t capacity = DefaultCapacity);
+
+    void Reset();
+
+    void Capture(const Core& core);
+    bool StepBack(Core& core);
+
+    size_t GetFrameCount() const { return m_Count; }
+    size_t GetUsedBytes() const { return m_Used; }
+private:
+    std::vector<uint8_t> m_Ring;
+    size_t m_Head;                  // Offset just past the newest entry
+    size_t m_Tail;                  // Offset of the oldest entry
+    size_t m_Used;
+    size_t m_Count;
+    CoreSnapshot m_Current;         // State at the newest entry
+    CoreSnapshot m_Next;
+    bool m_HasCurrent;
+    std::vector<uint8_t> m_Delta;   // Scratch space for one encoded delta
+
+    void Write(size_t offset, const void* data, size_t length);
+    void Read(size_t offset, void* data, size_t length) const;
+    void Push(const uint8_t* data, uint32_t length);
+    void DropOldest();
+};
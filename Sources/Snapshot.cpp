@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "Snapshot.h"
+
+/*
+ * Snapshots are compressed with a byte-oriented LZ77 in the style of LZ4.
+ * Each sequence is a token, whose high nibble is the number of literals and
+ * low nibble the match length minus MinimumMatch, then the literals and a
+ * 16-bit offset back into the output. A nibble of 15 is followed by bytes
+ * that add to the length until one is below 255. The last sequence has
+ * only literals. Memory and display are mostly runs, so a snapshot usually
+ * shrinks to a few hundred bytes.
+ */
+static constexpr size_t MinimumMatch = 4;
+static constexpr size_t MaximumOffset = 0xFFFF;
+static constexpr int    HashBits = 12;
+
+/* File layout: "C8SZ", uncompressed size, compressed snapshot */
+static constexpr char   s_Magic[4] = { 'C', '8', 'S', 'Z' };
+
+/* CoreSnapshot is written as it is in memory, which is the little-endian layout the format defines */
+static_assert(std::endian::native == std::endian::little);
+
+static uint32_t Read32(const uint8_t* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static void PutLength(std::vector<uint8_t>& out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        out.push_back(255);
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+static bool GetLength(const uint8_t*& data, const uint8_t* end, size_t& length)
+{
+    uint8_t byte;
+    do
+    {
+        if (data == end)
+            return false;
+        byte = *data++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+static void PutSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength)
+{
+    size_t match = matchLength ? matchLength - MinimumMatch : 0;
+
+    out.push_back(static_cast<uint8_t>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(match, 15)));
+    if (literalCount >= 15)
+        PutLength(out, literalCount - 15);
+    out.insert(out.end(), literals, literals + literalCount);
+
+    if (matchLength == 0)
+        return;
+
+    out.push_back(static_cast<uint8_t>(offset));
+    out.push_back(static_cast<uint8_t>(offset >> 8));
+    if (match >= 15)
+        PutLength(out, match - 15);
+}
+
+/**
+ * Compress a snapshot for storage
+ * @param snapshot Snapshot to compress
+ * @param out      Receives the compressed bytes
+ */
+void CompressSnapshot(const CoreSnapshot& snapshot, std::vector<uint8_t>& out)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(&snapshot);
+    const size_t length = sizeof(CoreSnapshot);
+    int table[1 << HashBits];
+    size_t anchor = 0;
+    size_t position = 0;
+
+    std::fill_n(table, 1 << HashBits, -1);
+    out.clear();
+
+    while (position + MinimumMatch <= length)
+    {
+        uint32_t sequence = Read32(in + position);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HashBits);
+        int candidate = table[hash];
+
+        table[hash] = static_cast<int>(position);
+        if (candidate < 0 || position - candidate > MaximumOffset || Read32(in + candidate) != sequence)
+        {
+            position++;
+            continue;
+        }
+
+        size_t matchLength = MinimumMatch;
+        while (position + matchLength < length && in[candidate + matchLength] == in[position + matchLength])
+            matchLength++;
+
+        PutSequence(out, in + anchor, position - anchor, position - candidate, matchLength);
+        position += matchLength;
+        anchor = position;
+    }
+
+    PutSequence(out, in + anchor, length - anchor, 0, 0);
+}
+
+/**
+ * Decompress a snapshot written by CompressSnapshot
+ * @param data     Compressed bytes
+ * @param length   Number of compressed bytes
+ * @param snapshot Receives the snapshot
+ * @return True on success, false if the data is corrupt
+ */
+bool DecompressSnapshot(const uint8_t* data, size_t length, CoreSnapshot& snapshot)
+{
+    uint8_t* out = reinterpret_cast<uint8_t*>(&snapshot);
+    const uint8_t* end = data + length;
+    size_t written = 0;
+
+    while (data < end)
+    {
+        uint8_t token = *data++;
+        size_t literalCount = token >> 4;
+        size_t matchLength = token & 0xF;
+
+        if (literalCount == 15 && !GetLength(data, end, literalCount))
+            return false;
+        if (literalCount > static_cast<size_t>(end - data) || literalCount > sizeof(CoreSnapshot) - written)
+            return false;
+        memcpy(out + written, data, literalCount);
+        data += literalCount;
+        written += literalCount;
+
+        if (data == end)
+            break;
+
+        if (end - data < 2)
+            return false;
+        size_t offset = data[0] | (data[1] << 8);
+        data += 2;
+
+        if (matchLength == 15 && !GetLength(data, end, matchLength))
+            return false;
+        matchLength += MinimumMatch;
+
+        if (offset == 0 || offset > written || matchLength > sizeof(CoreSnapshot) - written)
+            return false;
+
+        /* Byte by byte, a match can overlap the bytes it produces */
+        for (size_t i = 0; i < matchLength; i++, written++)
+            out[written] = out[written - offset];
+    }
+
+    return written == sizeof(CoreSnapshot);
+}
+
+/**
+ * Write a compressed snapshot to a file
+ * @param path     File to write
+ * @param snapshot Snapshot to write
+ * @return True on success, false otherwise
+ */
+bool SaveSnapshot(const std::filesystem::path& path, const CoreSnapshot& snapshot)
+{
+    std::vector<uint8_t> compressed;
+    uint32_t size = sizeof(CoreSnapshot);
+
+    CompressSnapshot(snapshot, compressed);
+
+    std::ofstream output(path, std::ios::binary | std::ios::out);
+    output.write(s_Magic, sizeof(s_Magic));
+    output.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    output.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+    if (!output)
+    {
+        printf("ERROR: failed to write '%s'\n", path.string().c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read a snapshot written by SaveSnapshot
+ * @param path     File to read
+ * @param snapshot Receives the snapshot
+ * @return True on success, false if the file could not be read or is not a snapshot
+ */
+bool LoadSnapshot(const std::filesystem::path& path, CoreSnapshot& snapshot)
+{
+    std::ifstream input(path, std::ios::binary | std::ios::in);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    if (!input.is_open())
+    {
+        printf("ERROR: failed to read '%s'\n", path.string().c_str());
+        return false;
+    }
+
+    if (data.size() < 8 || !std::equal(std::begin(s_Magic), std::end(s_Magic), data.begin())
+        || Read32(&data[4]) != sizeof(CoreSnapshot)
+        || !DecompressSnapshot(data.data() + 8, data.size() - 8, snapshot)
+        || snapshot.magic != CoreSnapshot::Magic || snapshot.version != CoreSnapshot::Version)
+    {
+        printf("ERROR: '%s' is not a snapshot for this version of the emulator\n", path.string().c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include "Core.h"
+
+void CompressSnapshot(const CoreSnapshot& snapshot, std::vector<uint8_t>& out);
+bool DecompressSnapshot(const uint8_t* data, size_t length, CoreSnapshot& snapshot);
+
+bool SaveSnapshot(const std::filesystem::path& path, const CoreSnapshot& snapshot);
+bool LoadSnapshot(const std::filesystem::path& path, CoreSnapshot& snapshot);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Fixed-size ring buffer for exactly one producer thread and one consumer
+ * thread. Neither side locks or allocates, so the consumer can be a
+ * real-time callback.
+ */
+template <class T, size_t Capacity>
+class SpscRing
+{
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+public:
+    using value_type = T;
+
+    SpscRing()
+        : m_Head(0), m_Tail(0), m_Items{ }
+    { }
+
+    /* Producer only. Returns false if the ring is full. */
+    bool Push(const value_type& item)
+    {
+        size_t head = m_Head.load(std::memory_order_relaxed);
+        if (head - m_Tail.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        m_Items[head & (Capacity - 1)] = item;
+        m_Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Consumer only. The oldest item, or nullptr if the ring is empty. */
+    const value_type* Peek() const
+    {
+        size_t tail = m_Tail.load(std::memory_order_relaxed);
+        if (tail == m_Head.load(std::memory_order_acquire))
+            return nullptr;
+        return &m_Items[tail & (Capacity - 1)];
+    }
+
+    /* Consumer only. Drops the item returned by Peek. */
+    void Pop()
+    {
+        m_Tail.store(m_Tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+private:
+    /* Each index on its own cache line so the two threads do not share one */
+    alignas(64) std::atomic<size_t> m_Head;
+    alignas(64) std::atomic<size_t> m_Tail;
+    std::array<value_type, Capacity> m_Items;
+};
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include "SymbolTable.h"
+
+static constexpr size_t MinimumSlots = 64;
+
+SymbolTable::SymbolTable()
+    : m_Slots(MinimumSlots, -1)
+{
+
+}
+
+/**
+ * Make room for a number of symbols so interning them never rehashes
+ * @param count Expected number of distinct symbols
+ */
+void SymbolTable::Reserve(size_t count)
+{
+    size_t slots = MinimumSlots;
+    while (slots < count * 2)
+        slots *= 2;
+
+    m_Entries.reserve(count);
+    m_Pool.reserve(count * 8);
+    if (slots > m_Slots.size())
+        Rehash(slots);
+}
+
+void SymbolTable::Clear()
+{
+    m_Pool.clear();
+    m_Entries.clear();
+    std::fill(m_Slots.begin(), m_Slots.end(), -1);
+}
+
+/**
+ * Get the id of a symbol, adding it as undefined if it is new
+ * @param name Symbol name, which is copied into the pool
+ * @return Symbol id
+ */
+int SymbolTable::Intern(std::string_view name)
+{
+    uint32_t hash = Hash(name);
+    size_t slot = FindSlot(name, hash);
+
+    if (m_Slots[slot] != -1)
+        return m_Slots[slot];
+
+    int id = static_cast<int>(m_Entries.size());
+    m_Entries.push_back({ static_cast<uint32_t>(m_Pool.size()), static_cast<uint32_t>(name.size()), hash, Undefined });
+    m_Pool.append(name);
+    m_Slots[slot] = id;
+
+    /* Keep the load factor at or below one half */
+    if (m_Entries.size() * 2 > m_Slots.size())
+        Rehash(m_Slots.size() * 2);
+
+    return id;
+}
+
+/**
+ * Get the id of a symbol without adding it
+ * @param name Symbol name
+ * @return Symbol id, or -1 if the name was never interned
+ */
+int SymbolTable::Find(std::string_view name) const
+{
+    return m_Slots[FindSlot(name, Hash(name))];
+}
+
+/* FNV-1a, which is cheap for the short names assembly programs use */
+uint32_t SymbolTable::Hash(std::string_view name)
+{
+    uint32_t hash = 2166136261u;
+    for (char c : name)
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    return hash;
+}
+
+/**
+ * Linear probe for a name
+ * @return The slot holding the name, or the empty slot where it would go
+ */
+size_t SymbolTable::FindSlot(std::string_view name, uint32_t hash) const
+{
+    size_t mask = m_Slots.size() - 1;
+    size_t slot = hash & mask;
+
+    while (m_Slots[slot] != -1)
+    {
+        const Entry& entry = m_Entries[m_Slots[slot]];
+        if (entry.hash == hash && GetName(m_Slots[slot]) == name)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void SymbolTable::Rehash(size_t slotCount)
+{
+    size_t mask = slotCount - 1;
+
+    m_Slots.assign(slotCount, -1);
+    for (size_t id = 0; id < m_Entries.size(); id++)
+    {
+        size_t slot = m_Entries[id].hash & mask;
+        while (m_Slots[slot] != -1)
+            slot = (slot + 1) & mask;
+        m_Slots[slot] = static_cast<int>(id);
+    }
+}
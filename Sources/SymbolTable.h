@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Interns symbol names into one string pool and hands out dense integer ids,
+ * so the assembler only hashes a name once and works with ids afterwards
+ */
+class SymbolTable
+{
+public:
+    static constexpr int Undefined = -1;
+
+    SymbolTable();
+
+    void Reserve(size_t count);
+    void Clear();
+
+    int Intern(std::string_view name);
+    int Find(std::string_view name) const;
+
+    std::string_view GetName(int id) const { return std::string_view(m_Pool.data() + m_Entries[id].offset, m_Entries[id].length); }
+    int  GetValue(int id) const { return m_Entries[id].value; }
+    void SetValue(int id, int value) { m_Entries[id].value = value; }
+    bool IsDefined(int id) const { return m_Entries[id].value != Undefined; }
+    size_t GetCount() const { return m_Entries.size(); }
+private:
+    struct Entry
+    {
+        uint32_t offset;    // Start of the name in m_Pool
+        uint32_t length;
+        uint32_t hash;
+        int      value;     // Address, or Undefined
+    };
+
+    std::string        m_Pool;
+    std::vector<Entry> m_Entries;
+    std::vector<int>   m_Slots;     // Open-addressed ids into m_Entries, -1 when empty
+
+    static uint32_t Hash(std::string_view name);
+    size_t FindSlot(std::string_view name, uint32_t hash) const;
+    void Rehash(size_t slotCount);
+};
@@ -1,141 +1,411 @@
-#include <stdexcept>
-#include "StringUtil.h"
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <thread>
 #include "Assembler.h"
 
-static std::unordered_map<std::string, Keyword> s_KeyWords = {
-    { "CLS",  Keyword::CLS  },
-    { "RET",  Keyword::RET  },
-    { "SYS",  Keyword::SYS  },
-    { "JP",   Keyword::JP   },
-    { "CALL", Keyword::CALL },
-    { "SE",   Keyword::SE   },
-    { "SNE",  Keyword::SNE  },
-    { "LD",   Keyword::LD   },
-    { "ADD",  Keyword::ADD  },
-    { "OR",   Keyword::OR   },
-    { "XOR",  Keyword::XOR  },
-    { "AND",  Keyword::AND  },
-    { "SUB",  Keyword::SUB  },
-    { "SHL",  Keyword::SHL  },
-    { "SHR",  Keyword::SHR  },
-    { "SUBN", Keyword::SUBN },
-    { "RND",  Keyword::RND  },
-    { "DRW",  Keyword::DRW  },
-    { "SKP",  Keyword::SKP  },
-    { "SKNP", Keyword::SKNP },
-
-    { "V0", Keyword::V0 },
-    { "V1", Keyword::V1 },
-    { "V2", Keyword::V2 },
-    { "V3", Keyword::V3 },
-    { "V4", Keyword::V4 },
-    { "V5", Keyword::V5 },
-    { "V6", Keyword::V6 },
-    { "V7", Keyword::V7 },
-    { "V8", Keyword::V8 },
-    { "V9", Keyword::V9 },
-    { "VA", Keyword::VA },
-    { "VB", Keyword::VB },
-    { "VC", Keyword::VC },
-    { "VD", Keyword::VD },
-    { "VE", Keyword::VE },
-    { "VF", Keyword::VF },
-    { "DT", Keyword::DT },
-    { "ST", Keyword::ST },
-    { "I",  Keyword::I },
-
-    { "K",  Keyword::K },
-    { "F",  Keyword::F },
-    { "B",  Keyword::B }
+static constexpr char FoldCase(char c)
+{
+    return (c >= 'a' && c <= 'z') ? static_cast<char>(c - ('a' - 'A')) : c;
+}
+
+/* Keyword spellings, indexed by Keyword */
+static constexpr std::string_view s_KeywordNames[] = {
+    "CLS", "RET", "SYS", "JP", "CALL", "SE", "SNE", "LD", "ADD", "OR",
+    "XOR", "AND", "SUB", "SHL", "SHR", "SUBN", "RND", "DRW", "SKP", "SKNP",
+
+    "V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7", "V8", "V9",
+    "VA", "VB", "VC", "VD", "VE", "VF", "DT", "ST", "I", "K", "F", "B"
 };
 
-// TODO: Write custom tokenizing function instead of strtok
-// TODO: Handle expressions in parentheses
+static constexpr size_t KeywordCount = std::size(s_KeywordNames);
+static_assert(KeywordCount == static_cast<size_t>(Keyword::B) + 1, "s_KeywordNames must list every Keyword");
+
+static constexpr size_t MaxKeywordLength = 4;
 
-bool TokenizeLine(std::vector<Token>& tokensOut, int nLine, char* str)
+/* The seed was picked offline so every keyword lands in its own slot */
+static constexpr uint32_t KeywordHashSeed = 0x3A;
+static constexpr int      KeywordHashBits = 8;
+
+/**
+ * Case-insensitive FNV-1a hash of a keyword candidate
+ * @param text Text to hash
+ * @return Slot in the keyword table
+ */
+static constexpr size_t HashKeyword(std::string_view text)
 {
-    const char* delimit = " \t";
-    char* token = nullptr;
-    char* context = nullptr;
-    char* temp = str;
-    int   tokens = 0;
+    uint32_t hash = KeywordHashSeed;
+    for (char c : text)
+        hash = (hash ^ static_cast<uint8_t>(FoldCase(c))) * 16777619u;
+    return hash >> (32 - KeywordHashBits);
+}
 
-    while (*temp != '\0')
+/* Maps a hash slot to the index of the only keyword that can live there, or -1 */
+static constexpr auto s_KeywordTable = [] {
+    std::array<int8_t, 1 << KeywordHashBits> table{ };
+    for (int8_t& slot : table)
+        slot = -1;
+    for (size_t i = 0; i < KeywordCount; i++)
+        table[HashKeyword(s_KeywordNames[i])] = static_cast<int8_t>(i);
+    return table;
+}();
+
+static constexpr bool IsKeywordHashPerfect()
+{
+    for (size_t i = 0; i < KeywordCount; i++)
     {
-        if (*temp == ',')
-            *temp = ' ';
-        ++temp;
+        if (s_KeywordTable[HashKeyword(s_KeywordNames[i])] != static_cast<int8_t>(i))
+            return false;
     }
+    return true;
+}
+static_assert(IsKeywordHashPerfect(), "keyword hash has collisions, pick a new KeywordHashSeed");
+
+
+static inline bool IsSeparator(char c)
+{
+    return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+static inline bool IsBinaryOperator(char c)
+{
+    return c != '(' && c != ')' && IsExpressionOperator(c);
+}
+
+static inline bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/**
+ * Check if the blanks at str[i] are inside an expression like "A - B",
+ * where a binary operator has blanks on both sides. "JP -1" stays two tokens.
+ */
+static bool IsOperatorSpace(std::string_view str, size_t start, size_t i)
+{
+    if (!IsBlank(str[i]))
+        return false;
+
+    size_t op = i;
+    while (op > start && IsBinaryOperator(str[op - 1]))
+        --op;
+    if (op < i && op > start && IsBlank(str[op - 1]))
+        return true;
+
+    while (i < str.size() && IsBlank(str[i]))
+        ++i;
+    if (i >= str.size() || !IsBinaryOperator(str[i]))
+        return false;
+
+    while (i < str.size() && IsBinaryOperator(str[i]))
+        ++i;
+    return i < str.size() && IsBlank(str[i]);
+}
+
+/**
+ * Look up an instruction or register name, ignoring case
+ * @param text    Name to look up
+ * @param keyword Receives the keyword
+ * @return True if text is a keyword, false otherwise
+ */
+bool LookupKeyword(std::string_view text, Keyword& keyword)
+{
+    if (text.empty() || text.size() > MaxKeywordLength)
+        return false;
+
+    int8_t index = s_KeywordTable[HashKeyword(text)];
+    if (index < 0)
+        return false;
+
+    std::string_view name = s_KeywordNames[index];
+    if (name.size() != text.size())
+        return false;
+
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (FoldCase(text[i]) != name[i])
+            return false;
+    }
+
+    keyword = static_cast<Keyword>(index);
+    return true;
+}
+
+/**
+ * Parse a whole string as an integer. Like C literals, a 0x prefix means hex
+ * and a leading 0 means octal; 0b is also accepted for binary.
+ * @param text  Text to parse
+ * @param value Receives the value
+ * @return True if all of text is a valid integer, false otherwise
+ */
+bool ParseInteger(std::string_view text, int& value)
+{
+    long long result = 0;
+    bool negative = false;
+    int  base = 10;
+    size_t i = 0;
+
+    if (i < text.size() && (text[i] == '-' || text[i] == '+'))
+        negative = text[i++] == '-';
+
+    if (text.size() - i > 1 && text[i] == '0')
+    {
+        char prefix = FoldCase(text[i + 1]);
+        if (prefix == 'X')
+        {
+            base = 16;
+            i += 2;
+        }
+        else if (prefix == 'B')
+        {
+            base = 2;
+            i += 2;
+        }
+        else
+        {
+            base = 8;
+            i += 1;
+        }
+    }
+
+    if (i >= text.size())
+        return false;
+
+    for (; i < text.size(); i++)
+    {
+        char c = FoldCase(text[i]);
+        int  digit = 0;
+
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false;
+
+        if (digit >= base)
+            return false;
+
+        result = (result * base) + digit;
+        if (result > INT_MAX)
+            return false;
+    }
+
+    value = static_cast<int>(negative ? -result : result);
+    return true;
+}
 
-    token = strtok_s(str, delimit, &context);
-    while (token != NULL)
+/**
+ * Break down one line of code into tokens that point into it
+ * @param  tokensOut Vector to receive tokens
+ * @param  nLine     Line number, counting from 1
+ * @param  str       The line, without its line break
+ * @param  report    Print errors as they are found
+ * @return True on success, false otherwise
+ */
+static bool LexLine(std::vector<Token>& tokensOut, int nLine, std::string_view str, bool report)
+{
+    size_t i = 0;
+    bool   ok = true;
+
+    while (i < str.size())
     {
-        Token tok(token);
-        std::string normalized = ToUpper(tok.text);
+        if (IsSeparator(str[i]))
+        {
+            ++i;
+            continue;
+        }
+
+        /* Separators inside parentheses belong to the expression, and so do spaces around operators */
+        size_t start = i;
+        int    depth = 0;
+        bool   hasOperator = false;
+
+        while (i < str.size() && (depth > 0 || !IsSeparator(str[i]) || IsOperatorSpace(str, start, i)))
+        {
+            if (IsSeparator(str[i]) && depth == 0)
+            {
+                ++i;
+                continue;
+            }
+
+            if (str[i] == '(')
+                ++depth;
+            else if (str[i] == ')' && --depth < 0)
+                break;
+            hasOperator |= IsExpressionOperator(str[i]);
+            ++i;
+        }
+
+        Token tok(str.substr(start, i - start), Token::Type::Identifier, nLine, static_cast<int>(start) + 1);
+
+        if (depth != 0)
+        {
+            if (report)
+                AssemblerError(nLine, static_cast<int>(i) + 1, (depth > 0) ? "missing ')'" : "unexpected ')'");
+            ok = false;
+            i = str.size();
+            continue;
+        }
 
         /* Figure out what kind of token it is */
-        if (token[0] == '.')
+        if (tok.text[0] == '.')
         {
             tok.type = Token::Type::Directive;
         }
-        else if (token[0] == '#')
+        else if (tok.text[0] == '#')
         {
-            try
+            if (ParseInteger(tok.text.substr(1), tok.value))
             {
-                tok.value = std::stoi(tok.text.substr(1), nullptr, 0);
+                tok.type = Token::Type::Immediate;
             }
-            catch (const std::invalid_argument&)
+            else if (tok.text.size() > 1 && !(tok.text[1] >= '0' && tok.text[1] <= '9' && !hasOperator))
             {
-                printf("ERROR at line %d: invalid immediate value '%s'\n", nLine, tok.text.c_str());
-                return false;
+                tok.type = Token::Type::Expression;
+            }
+            else
+            {
+                if (report)
+                    AssemblerError(tok, "invalid immediate value '%.*s'", (int)tok.text.size(), tok.text.data());
+                ok = false;
+                continue;
             }
-            tok.type = Token::Type::Immediate;
         }
-        else if (token[tok.text.length() - 1] == ':')
+        else if (tok.text.back() == ':' && !hasOperator)
         {
-            tok.text.erase(tok.text.length() - 1);
+            tok.text.remove_suffix(1);
             tok.type = Token::Type::Label;
         }
-        else if (s_KeyWords.count(normalized) != 0)
+        else if (hasOperator)
+        {
+            tok.type = Token::Type::Expression;
+        }
+        else if (LookupKeyword(tok.text, tok.keyword))
         {
-            tok.text = normalized;
             tok.type = Token::Type::Keyword;
-            tok.keyword = s_KeyWords.at(normalized);
         }
 
-        tok.line = nLine;
         tokensOut.push_back(tok);
-        token = strtok_s(nullptr, delimit, &context);
-        ++tokens;
     }
 
-    return true;
+    return ok;
+}
+
+bool TokenizeLine(std::vector<Token>& tokensOut, int nLine, std::string_view str)
+{
+    return LexLine(tokensOut, nLine, str, true);
 }
 
 /**
- * Break down a block of code into a vector of tokens
- * @param  tokensOut Vector to receive tokens
- * @param  str       String containing code
+ * Tokenize consecutive lines
+ * @param tokensOut Vector to receive tokens
+ * @param str       Lines of code
+ * @param nLine     Number of the first line, counting from 1
+ * @param report    Print errors as they are found
+ * @param ok        Cleared if any line has an error
+ * @return Number of lines in str
+ */
+static int LexLines(std::vector<Token>& tokensOut, std::string_view str, int nLine, bool report, bool& ok)
+{
+    size_t start = 0;
+    int    first = nLine;
+
+    while (start < str.size())
+    {
+        size_t end = str.find('\n', start);
+        if (end == std::string_view::npos)
+            end = str.size();
+
+        if (!LexLine(tokensOut, nLine, str.substr(start, end - start), report))
+            ok = false;
+
+        start = end + 1;
+        ++nLine;
+    }
+
+    return nLine - first;
+}
+
+/* Sources are split into chunks of at least this many bytes, one per thread */
+static constexpr size_t MinimumChunkSize = 256 * 1024;
+
+/**
+ * Break down a block of code into a vector of tokens. Large sources are cut
+ * into line-aligned chunks that are lexed in parallel, then joined in order.
+ * @param  tokensOut Vector to receive tokens, which point into str
+ * @param  str       String containing code, which must outlive the tokens
  * @return True on success, false otherwise
  */
-bool TokenizeCode(std::vector<Token>& tokensOut, const std::string& str)
+bool TokenizeCode(std::vector<Token>& tokensOut, std::string_view str)
 {
-    char* codeBuffer = new char[str.length() + 1];
-    strcpy_s(codeBuffer, str.length() + 1, str.c_str());
+    size_t chunkCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), str.size() / MinimumChunkSize);
+    bool   ok = true;
+
+    if (chunkCount < 2)
+    {
+        LexLines(tokensOut, str, 1, true, ok);
+        return ok;
+    }
+
+    struct Chunk
+    {
+        std::string_view   text;
+        std::vector<Token> tokens;
+        int                lines;
+        bool               ok;
+    };
 
-    const char* delimit = "\r\n";
-    char* line = nullptr;
-    char* context = nullptr;
-    int   nLine = 0;
+    std::vector<Chunk> chunks(chunkCount);
+    std::vector<std::thread> workers;
+    size_t start = 0;
 
-    line = strtok_s(codeBuffer, delimit, &context);
-    while (line != NULL)
+    for (size_t i = 0; i < chunkCount; i++)
     {
-        TokenizeLine(tokensOut, nLine, line);
-        line = strtok_s(nullptr, delimit, &context);
-        ++nLine;
+        size_t end = (i + 1 == chunkCount) ? str.size() : str.find('\n', str.size() * (i + 1) / chunkCount);
+        end = (end == std::string_view::npos) ? str.size() : std::max(end + 1, start);
+
+        chunks[i].text = str.substr(start, end - start);
+        chunks[i].ok = true;
+        start = end;
+    }
+
+    for (Chunk& chunk : chunks)
+    {
+        workers.emplace_back([&chunk] {
+            chunk.tokens.reserve(chunk.text.size() / 4 + 16);
+            chunk.lines = LexLines(chunk.tokens, chunk.text, 1, false, chunk.ok);
+        });
+    }
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    /* Errors are rare, so report them with a sequential pass that prints them in order */
+    for (const Chunk& chunk : chunks)
+    {
+        if (!chunk.ok)
+        {
+            std::vector<Token> discard;
+            LexLines(discard, str, 1, true, ok);
+            return false;
+        }
+    }
+
+    size_t total = tokensOut.size();
+    for (const Chunk& chunk : chunks)
+        total += chunk.tokens.size();
+    tokensOut.reserve(total);
+
+    int firstLine = 0;
+    for (const Chunk& chunk : chunks)
+    {
+        for (const Token& token : chunk.tokens)
+        {
+            tokensOut.push_back(token);
+            tokensOut.back().line += firstLine;
+        }
+        firstLine += chunk.lines;
     }
 
-    delete[] codeBuffer;
     return true;
 }
\ No newline at end of file
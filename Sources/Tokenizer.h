@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
 enum class Keyword : int
 {
     CLS,
@@ -41,20 +45,24 @@ struct Token
         Expression
     };
 
-    std::string  text;
+    std::string_view text;      // Slice of the source, which must outlive the token
     Type         type;
     int          line;
+    int          column;
     int          address;
 
     union
     {
         Keyword      keyword;
         int          value;
+        int          symbol;    // Symbol id of labels and identifiers, once interned
     };
 
-    Token(const std::string& _text, Type _type = Type::Identifier, int _line = 0, int _value = 0, uint16_t _address = 0)
-        : type(_type), text(_text), line(_line), value(_value), address(_address) { }
+    Token(std::string_view _text, Type _type = Type::Identifier, int _line = 0, int _column = 0, int _value = 0, uint16_t _address = 0)
+        : text(_text), type(_type), line(_line), column(_column), address(_address), value(_value) { }
 };
 
-bool TokenizeLine(std::vector<Token>& tokensOut, int nLine, char* str);
-bool TokenizeCode(std::vector<Token>& tokensOut, const std::string& str);
\ No newline at end of file
+bool LookupKeyword(std::string_view text, Keyword& keyword);
+bool ParseInteger(std::string_view text, int& value);
+bool TokenizeLine(std::vector<Token>& tokensOut, int nLine, std::string_view str);
+bool TokenizeCode(std::vector<Token>& tokensOut, std::string_view str);
\ No newline at end of file
@@ -0,0 +1,497 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "Trace.h"
+#include "Disassembler.h"
+#include "Instruction.h"
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/*
+ * File layout: "C8TR", version, then blocks of a record count, an encoded
+ * length and the encoded records. Each record starts with a byte of flags
+ * saying which fields follow; a field is left out when the decoder can
+ * predict it:
+ *
+ *   ip      when it is not the previous ip + 2, or + 4 with FlagSkip
+ *   word    when it is not the word last seen at that address
+ *   reg     with its value, when a register changed
+ *   I       when it changed
+ *
+ * Predictions restart at every block, so blocks decode independently.
+ */
+static constexpr char     s_Magic[4] = { 'C', '8', 'T', 'R' };
+static constexpr uint16_t TraceVersion = 1;
+static constexpr size_t   BlockRecords = 1 << 16;
+static constexpr size_t   ChangeColumn = 28;      // Where decoded lines list the changed registers
+
+enum : uint8_t
+{
+    FlagJump = 0x01,
+    FlagSkip = 0x02,
+    FlagWord = 0x04,
+    FlagRegister = 0x08,
+    FlagI = 0x10,
+    FlagContinuation = 0x20
+};
+
+static TraceRecord* MapRing(size_t count)
+{
+#ifdef _WIN32
+    return static_cast<TraceRecord*>(VirtualAlloc(nullptr, count * sizeof(TraceRecord), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+    void* data = mmap(nullptr, count * sizeof(TraceRecord), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (data == MAP_FAILED) ? nullptr : static_cast<TraceRecord*>(data);
+#endif
+}
+
+static void UnmapRing(TraceRecord* ring, size_t count)
+{
+#ifdef _WIN32
+    VirtualFree(ring, 0, MEM_RELEASE);
+#else
+    munmap(ring, count * sizeof(TraceRecord));
+#endif
+}
+
+static void Put16(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+static void Put32(std::vector<uint8_t>& out, uint32_t value)
+{
+    Put16(out, static_cast<uint16_t>(value));
+    Put16(out, static_cast<uint16_t>(value >> 16));
+}
+
+static uint16_t Get16(const uint8_t* data)
+{
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+static uint32_t Get32(const uint8_t* data)
+{
+    return Get16(data) | (static_cast<uint32_t>(Get16(data + 2)) << 16);
+}
+
+static uint8_t* Put16(uint8_t* out, uint16_t value)
+{
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+    return out + 2;
+}
+
+/**
+ * Encode consecutive records of the ring
+ * @param ring  Ring
+ * @param mask  Capacity of the ring minus one
+ * @param first Index of the first record
+ * @param count Number of records
+ * @param out   Receives the encoded block, without its header
+ */
+static void EncodeBlock(const TraceRecord* ring, size_t mask, size_t first, size_t count, std::vector<uint8_t>& out)
+{
+    std::array<uint16_t, Core::MemorySize> words{ };
+    uint16_t next = 0;
+    uint16_t i = 0;
+
+    /* At most a byte of flags and four 16-bit fields per record */
+    out.resize(count * 9);
+    uint8_t* p = out.data();
+
+    for (size_t index = first; index < first + count; index++)
+    {
+        const TraceRecord& record = ring[index & mask];
+        uint8_t* flags = p++;
+
+        *flags = 0;
+        if (record.ip == TraceRecord::Continuation)
+            *flags |= FlagContinuation;
+        else
+        {
+            uint16_t& word = words[record.ip & Core::AddressMask];
+
+            if (record.ip == static_cast<uint16_t>(next + 2))
+                *flags |= FlagSkip;
+            else if (record.ip != next)
+            {
+                *flags |= FlagJump;
+                p = Put16(p, record.ip);
+            }
+
+            if (record.word != word)
+            {
+                *flags |= FlagWord;
+                p = Put16(p, record.word);
+                word = record.word;
+            }
+            next = record.ip + 2;
+        }
+
+        if (record.reg != TraceRecord::NoRegister)
+        {
+            *flags |= FlagRegister;
+            *p++ = record.reg;
+            *p++ = record.value;
+        }
+
+        if (record.i != i)
+        {
+            *flags |= FlagI;
+            p = Put16(p, record.i);
+            i = record.i;
+        }
+    }
+    out.resize(p - out.data());
+}
+
+Tracer::Tracer(size_t capacity)
+    : m_Ring(nullptr), m_Capacity(std::bit_ceil(std::max(capacity, 2 * BlockRecords))), m_Head(0), m_CachedTail(0),
+    m_PublishedHead(0), m_Tail(0), m_Stopping(false), m_Failed(false)
+{
+    m_Ring = MapRing(m_Capacity);
+    if (m_Ring == nullptr)
+        printf("ERROR: failed to map %zu bytes for the trace ring\n", m_Capacity * sizeof(TraceRecord));
+}
+
+Tracer::~Tracer()
+{
+    Close();
+    if (m_Ring)
+        UnmapRing(m_Ring, m_Capacity);
+}
+
+/**
+ * Start writing records to a file
+ * @param path File to write
+ * @return True on success, false otherwise
+ */
+bool Tracer::Open(const std::filesystem::path& path)
+{
+    std::vector<uint8_t> header(std::begin(s_Magic), std::end(s_Magic));
+
+    Close();
+    if (m_Ring == nullptr)
+        return false;
+
+    Put16(header, TraceVersion);
+    Put16(header, 0);
+
+    m_Output.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    m_Output.write(reinterpret_cast<const char*>(header.data()), header.size());
+    if (!m_Output)
+    {
+        printf("ERROR: failed to write '%s'\n", path.string().c_str());
+        m_Output.close();
+        return false;
+    }
+
+    m_Path = path;
+    m_Failed = false;
+    m_Stopping.store(false);
+    m_Writer = std::thread(&Tracer::WriterMain, this);
+    return true;
+}
+
+/**
+ * Write out the remaining records and close the file
+ * @return True if every record was written, false otherwise
+ */
+bool Tracer::Close()
+{
+    if (!m_Writer.joinable())
+        return !m_Failed;
+
+    m_PublishedHead.store(m_Head, std::memory_order_release);
+    m_Stopping.store(true, std::memory_order_release);
+    m_Writer.join();
+
+    m_Output.close();
+    if (m_Failed)
+        printf("ERROR: failed to write '%s'\n", m_Path.string().c_str());
+    return !m_Failed;
+}
+
+/**
+ * Run the core like Core::RunCycles, recording every instruction. Waits for
+ * the writer when the ring is full, so no record is lost.
+ * @param core   Core to run
+ * @param cycles Number of cycles to run
+ * @return Number of cycles run
+ */
+int Tracer::Run(Core& core, int cycles)
+{
+    const size_t mask = m_Capacity - 1;
+    const auto& registers = core.m_Registers;
+    int executed = 0;
+
+    if (m_Ring == nullptr)
+        return core.RunCycles(cycles);
+
+    while (executed < cycles)
+    {
+        core.ApplyInput();
+        if (core.m_WaitingForKey)
+        {
+            uint64_t idle = std::min<uint64_t>(cycles - executed, core.GetNextInputCycle() - core.m_Cycles);
+            core.m_Cycles += idle;
+            executed += static_cast<int>(idle);
+            continue;
+        }
+
+        if (m_Head + MaxRecordsPerInstruction - m_CachedTail > m_Capacity)
+            Reserve();
+
+        uint8_t v[16];
+        uint8_t dt = registers.dt;
+        uint8_t st = registers.st;
+        uint8_t sp = registers.sp;
+        memcpy(v, registers.v, sizeof(v));
+
+        TraceRecord& record = m_Ring[m_Head++ & mask];
+        record.ip = registers.ip;
+        record.word = core.ReadWord(registers.ip);
+
+        core.DoCycle();
+        executed++;
+
+        record.i = registers.i;
+        record.reg = TraceRecord::NoRegister;
+
+        /* The first change goes into the record itself, any others follow it */
+        auto change = [&](uint8_t reg, uint8_t value)
+        {
+            if (record.reg == TraceRecord::NoRegister)
+            {
+                record.reg = reg;
+                record.value = value;
+            }
+            else
+                m_Ring[m_Head++ & mask] = { TraceRecord::Continuation, 0, registers.i, reg, value };
+        };
+
+        if (memcmp(v, registers.v, sizeof(v)) != 0)
+        {
+            for (uint8_t r = 0; r < 16; r++)
+            {
+                if (v[r] != registers.v[r])
+                    change(r, registers.v[r]);
+            }
+        }
+        if (dt != registers.dt)
+            change(TraceRecord::RegisterDT, registers.dt);
+        if (st != registers.st)
+            change(TraceRecord::RegisterST, registers.st);
+        if (sp != registers.sp)
+            change(TraceRecord::RegisterSP, registers.sp);
+    }
+
+    m_PublishedHead.store(m_Head, std::memory_order_release);
+    return executed;
+}
+
+/* Make room for the records of one more instruction */
+void Tracer::Reserve()
+{
+    /* Without a writer nobody reads the ring, so the oldest records are simply overwritten */
+    if (!m_Writer.joinable())
+    {
+        m_CachedTail = m_Head;
+        return;
+    }
+
+    m_PublishedHead.store(m_Head, std::memory_order_release);
+    m_CachedTail = m_Tail.load(std::memory_order_acquire);
+    while (m_Head + MaxRecordsPerInstruction - m_CachedTail > m_Capacity)
+    {
+        std::this_thread::yield();
+        m_CachedTail = m_Tail.load(std::memory_order_acquire);
+    }
+}
+
+void Tracer::WriterMain()
+{
+    std::vector<uint8_t> block;
+    std::vector<uint8_t> header;
+
+    for (;;)
+    {
+        size_t tail = m_Tail.load(std::memory_order_relaxed);
+        bool stopping = m_Stopping.load(std::memory_order_acquire);
+        size_t head = m_PublishedHead.load(std::memory_order_acquire);
+
+        /* Waiting for a full block keeps the per-block overhead small, the ring holds at least two */
+        if (head - tail < BlockRecords && !stopping)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        if (head == tail)
+            break;
+
+        size_t count = std::min(head - tail, BlockRecords);
+        EncodeBlock(m_Ring, m_Capacity - 1, tail, count, block);
+
+        header.clear();
+        Put32(header, static_cast<uint32_t>(count));
+        Put32(header, static_cast<uint32_t>(block.size()));
+        m_Output.write(reinterpret_cast<const char*>(header.data()), header.size());
+        m_Output.write(reinterpret_cast<const char*>(block.data()), block.size());
+        if (!m_Output)
+            m_Failed = true;
+
+        m_Tail.store(tail + count, std::memory_order_release);
+    }
+}
+
+static const char* GetRegisterName(uint8_t reg)
+{
+    static constexpr const char* s_Names[] = {
+        "V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7",
+        "V8", "V9", "VA", "VB", "VC", "VD", "VE", "VF",
+        "DT", "ST", "SP"
+    };
+    return (reg < std::size(s_Names)) ? s_Names[reg] : "??";
+}
+
+/**
+ * Decode a trace written by Tracer into one line of text per instruction,
+ * with the registers it changed
+ * @param path   Trace file
+ * @param output Text file to write
+ * @return True on success, false if the trace could not be read or is corrupt
+ */
+bool DecodeTrace(const std::filesystem::path& path, const std::filesystem::path& output)
+{
+    MappedFile file(path);
+    const uint8_t* data = file.GetData();
+    size_t size = file.GetSize();
+
+    if (!file.IsOpen())
+    {
+        printf("ERROR: failed to read '%s'\n", path.string().c_str());
+        return false;
+    }
+
+    if (size < 8 || memcmp(data, s_Magic, sizeof(s_Magic)) != 0 || Get16(data + 4) != TraceVersion)
+    {
+        printf("ERROR: '%s' is not a trace for this version of the emulator\n", path.string().c_str());
+        return false;
+    }
+
+    std::ofstream out(output, std::ios::binary | std::ios::out);
+    std::vector<uint16_t> words(Core::MemorySize);
+    std::string text;
+    char line[MaxDisassemblyLineLength + 16];
+    size_t lineLength = 0;
+    size_t offset = 8;
+
+    while (offset < size)
+    {
+        if (size - offset < 8 || Get32(data + offset + 4) > size - offset - 8)
+        {
+            printf("ERROR: '%s' is truncated\n", path.string().c_str());
+            return false;
+        }
+
+        uint32_t count = Get32(data + offset);
+        const uint8_t* p = data + offset + 8;
+        const uint8_t* end = p + Get32(data + offset + 4);
+        uint16_t next = 0;
+
+        offset = end - data;
+        std::fill(words.begin(), words.end(), 0);
+
+        for (uint32_t n = 0; n < count; n++)
+        {
+            uint8_t flags = (p < end) ? *p++ : 0xFF;
+            size_t needed = ((flags & FlagJump) ? 2 : 0) + ((flags & FlagWord) ? 2 : 0)
+                + ((flags & FlagRegister) ? 2 : 0) + ((flags & FlagI) ? 2 : 0);
+
+            if (flags > 0x3F || static_cast<size_t>(end - p) < needed)
+            {
+                printf("ERROR: '%s' is corrupt\n", path.string().c_str());
+                return false;
+            }
+
+            /* A line ends when the next instruction starts, its changes can be in the next block */
+            if (!(flags & FlagContinuation))
+            {
+                uint16_t ip = next;
+                if (flags & FlagJump)
+                {
+                    ip = Get16(p);
+                    p += 2;
+                }
+                else if (flags & FlagSkip)
+                    ip = next + 2;
+
+                uint16_t& word = words[ip & Core::AddressMask];
+                if (flags & FlagWord)
+                {
+                    word = Get16(p);
+                    p += 2;
+                }
+                next = ip + 2;
+
+                if (lineLength != 0)
+                    text += '\n';
+                int length = snprintf(line, sizeof(line), "0x%03X: ", ip);
+                length += static_cast<int>(FormatInstruction(line + length, Instruction(word)));
+                text.append(line, length);
+                lineLength = length;
+            }
+
+            if (flags & FlagRegister)
+            {
+                if (lineLength < ChangeColumn)
+                {
+                    text.append(ChangeColumn - lineLength, ' ');
+                    lineLength = ChangeColumn;
+                }
+                lineLength += snprintf(line, sizeof(line), " %s=%02X", GetRegisterName(p[0]), p[1]);
+                text += line;
+                p += 2;
+            }
+
+            if (flags & FlagI)
+            {
+                if (lineLength < ChangeColumn)
+                {
+                    text.append(ChangeColumn - lineLength, ' ');
+                    lineLength = ChangeColumn;
+                }
+                lineLength += snprintf(line, sizeof(line), " I=%03X", Get16(p));
+                text += line;
+                p += 2;
+            }
+        }
+
+        out.write(text.data(), text.size());
+        text.clear();
+    }
+
+    if (lineLength != 0)
+        out.put('\n');
+    if (!out)
+    {
+        printf("ERROR: failed to write '%s'\n", output.string().c_str());
+        return false;
+    }
+    return true;
+}
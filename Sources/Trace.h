@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include "Core.h"
+
+/* One executed instruction, or one more register it changed */
+struct TraceRecord
+{
+    constexpr static uint16_t Continuation = 0xFFFF;    // ip of records that only add a register change
+    constexpr static uint8_t  NoRegister = 0xFF;
+    constexpr static uint8_t  RegisterDT = 16;
+    constexpr static uint8_t  RegisterST = 17;
+    constexpr static uint8_t  RegisterSP = 18;
+
+    uint16_t ip;        // Address of the instruction, or Continuation
+    uint16_t word;      // Instruction word
+    uint16_t i;         // I after the instruction
+    uint8_t  reg;       // 0-15 for V0-VF, RegisterDT, RegisterST, RegisterSP or NoRegister
+    uint8_t  value;     // New value of reg
+};
+
+static_assert(sizeof(TraceRecord) == 8);
+
+/**
+ * Runs a core and records every instruction it executes to a file. Records
+ * go into a ring of mapped memory without locks, and a writer thread
+ * encodes them and writes them out, so the core only pays for filling in
+ * the records. Like Debugger, Core itself has no tracing hooks.
+ */
+class Tracer
+{
+public:
+    /* 8MB, about a second of records at full speed before the core waits for the writer */
+    constexpr static size_t DefaultCapacity = 1 << 20;
+
+    Tracer(size_t capacity = DefaultCapacity);
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    ~Tracer();
+
+    bool Open(const std::filesystem::path& path);
+    bool Close();
+
+    int Run(Core& core, int cycles);
+
+    uint64_t GetRecordCount() const { return m_Head; }
+private:
+    /* Most records an instruction can produce, for LD V0-VF, [I] */
+    constexpr static size_t MaxRecordsPerInstruction = 17;
+
+    TraceRecord* m_Ring;
+    size_t m_Capacity;      // Records, a power of two
+    size_t m_Head;          // Producer's next record, published through m_PublishedHead
+    size_t m_CachedTail;    // Last m_Tail the producer saw
+
+    alignas(64) std::atomic<size_t> m_PublishedHead;
+    alignas(64) std::atomic<size_t> m_Tail;
+    std::atomic<bool> m_Stopping;
+    std::thread m_Writer;
+    std::filesystem::path m_Path;
+    std::ofstream m_Output;     // Owned by the writer thread while it runs
+    bool m_Failed;
+
+    void Reserve();
+    void WriterMain();
+};
+
+bool DecodeTrace(const std::filesystem::path& path, const std::filesystem::path& output);